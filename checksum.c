@@ -0,0 +1,216 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SSE42_PATH 1
+/* the vector sums treat bytes as signed, like (int)char does on this target */
+#if CHAR_MIN < 0
+#define HAVE_SIMD_SUM 1
+#endif
+#endif
+#include "checksum.h"
+
+/* ******************************************************************
+   Checksum kernels.
+
+   crc32c() and sum_bytes() pick their implementation once, on first use
+   or at load time where the compiler supports constructors, so the
+   choice costs one indirect call per packet afterwards.
+**********************************************************************/
+
+#define CRC32C_POLY 0x82f63b78u   /* reflected Castagnoli polynomial */
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len);
+static uint32_t (*crc32c_fn)(uint32_t, const unsigned char *, size_t);
+
+/* slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes */
+static void crc32c_init_tables(void)
+{
+  uint32_t crc;
+  int i, j, k;
+
+  for (i = 0; i < 256; i++) {
+    crc = (uint32_t)i;
+    for (j = 0; j < 8; j++)
+      crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    crc32c_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8)
+                           ^ crc32c_table[0][crc32c_table[k - 1][i] & 0xff];
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint32_t lo, hi;
+
+  /* words are assembled byte by byte so the result does not depend on endianness */
+  while (len >= 8) {
+    lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+    hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff]
+        ^ crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24]
+        ^ crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff]
+        ^ crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+  while (len-- > 0)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+  return crc;
+}
+
+#ifdef HAVE_SSE42_PATH
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t crc64 = crc;
+  uint64_t word;
+
+  /* x86 is little endian, so a plain load gives the byte order the CRC expects */
+  while (len >= 8) {
+    memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (len-- > 0)
+    crc = _mm_crc32_u8(crc, *p++);
+  return crc;
+}
+#endif
+
+/* additive sum of (int)char over a buffer, wrapping like the scalar int sum */
+static int sum_bytes_scalar(const char *p, size_t len)
+{
+  unsigned int sum = 0;
+
+  while (len-- > 0)
+    sum += (unsigned int)(int)*p++;
+  return (int)sum;
+}
+
+#ifdef HAVE_SIMD_SUM
+/* Flipping the top bit maps a signed byte b to the unsigned b + 128, so
+   psadbw against zero sums 8 bytes at a time into 64 bit lanes and the
+   bias of 128 per byte is taken off at the end. */
+static int sum_bytes_sse2(const char *p, size_t len)
+{
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+  uint64_t lanes[2];
+  size_t n = len & ~(size_t)15;
+  size_t i;
+
+  for (i = 0; i < n; i += 16)
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), bias), zero));
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return (int)((unsigned int)(lanes[0] + lanes[1] - 128 * (uint64_t)n)
+               + (unsigned int)sum_bytes_scalar(p + n, len - n));
+}
+
+__attribute__((target("avx2")))
+static int sum_bytes_avx2(const char *p, size_t len)
+{
+  const __m256i bias = _mm256_set1_epi8((char)0x80);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = _mm256_setzero_si256();
+  uint64_t lanes[4];
+  size_t n = len & ~(size_t)31;
+  size_t i;
+
+  for (i = 0; i < n; i += 32)
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i)), bias), zero));
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  return (int)((unsigned int)(lanes[0] + lanes[1] + lanes[2] + lanes[3] - 128 * (uint64_t)n)
+               + (unsigned int)sum_bytes_sse2(p + n, len - n));
+}
+#endif
+
+static int (*sum_bytes_fn)(const char *, size_t);
+
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void checksum_select(void)
+{
+  crc32c_init_tables();
+  crc32c_fn = crc32c_sw;
+#ifdef HAVE_SSE42_PATH
+  if (__builtin_cpu_supports("sse4.2"))
+    crc32c_fn = crc32c_sse42;
+#endif
+  sum_bytes_fn = sum_bytes_scalar;
+#ifdef HAVE_SIMD_SUM
+  sum_bytes_fn = sum_bytes_sse2;
+  if (__builtin_cpu_supports("avx2"))
+    sum_bytes_fn = sum_bytes_avx2;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+  if (crc32c_fn == NULL)
+    checksum_select();
+  return ~crc32c_fn(~crc, (const unsigned char *)buf, len);
+}
+
+const char *crc32c_impl_name(void)
+{
+  if (crc32c_fn == NULL)
+    checksum_select();
+#ifdef HAVE_SSE42_PATH
+  if (crc32c_fn == crc32c_sse42)
+    return "sse4.2";
+#endif
+  return "slicing-by-8";
+}
+
+int sum_bytes(const char *buf, size_t len)
+{
+  if (sum_bytes_fn == NULL)
+    checksum_select();
+  return sum_bytes_fn(buf, len);
+}
+
+int sum_bytes_use(int impl)
+{
+  if (sum_bytes_fn == NULL)
+    checksum_select();
+  switch (impl) {
+  case SUM_BYTES_SCALAR:
+    sum_bytes_fn = sum_bytes_scalar;
+    return 0;
+#ifdef HAVE_SIMD_SUM
+  case SUM_BYTES_SSE2:
+    sum_bytes_fn = sum_bytes_sse2;
+    return 0;
+  case SUM_BYTES_AVX2:
+    if (!__builtin_cpu_supports("avx2"))
+      return -1;
+    sum_bytes_fn = sum_bytes_avx2;
+    return 0;
+#endif
+  default:
+    return -1;
+  }
+}
+
+const char *sum_bytes_impl_name(void)
+{
+  if (sum_bytes_fn == NULL)
+    checksum_select();
+#ifdef HAVE_SIMD_SUM
+  if (sum_bytes_fn == sum_bytes_avx2)
+    return "avx2";
+  if (sum_bytes_fn == sum_bytes_sse2)
+    return "sse2";
+#endif
+  return "scalar";
+}
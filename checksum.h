@@ -0,0 +1,22 @@
+/* Checksum kernels shared by the sender and receiver, see checksum.c */
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli), continuing from crc: pass 0 to start a new checksum.
+   Uses the SSE4.2 crc32 instruction when the CPU has it, slicing-by-8 tables otherwise. */
+extern uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* which crc32c() implementation was picked for this CPU */
+extern const char *crc32c_impl_name(void);
+
+/* sum of (int)char over buf, wrapping, the payload part of ComputeChecksum().
+   Uses AVX2 or SSE2 when available, every path gives the same result. */
+extern int sum_bytes(const char *buf, size_t len);
+
+/* force one sum_bytes() implementation, for benchmarks. Not thread safe,
+   call before starting threads. Returns -1 if this CPU or build lacks it. */
+#define SUM_BYTES_SCALAR 0
+#define SUM_BYTES_SSE2   1
+#define SUM_BYTES_AVX2   2
+extern int sum_bytes_use(int impl);
+extern const char *sum_bytes_impl_name(void);
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "sim.h"
+#include "sr.h"
+#include "sr_metrics.h"
+#include "sr_trace.h"
+
+/* ******************************************************************
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2
+   Adapted from J.F.Kurose
+
+   Runs the protocol in A_init(), A_output() and friends over one
+   struct sim, see sim.c for the channel model.  Without arguments it
+   asks for its parameters like the classic emulator; with arguments
+   it takes them from the command line, see usage().
+
+   Build with the protocol, for example
+     gcc -O2 -pthread -o sr emulator.c sim.c sr.c checksum.c erasure.c sr_trace.c sr_metrics.c -lm
+**********************************************************************/
+
+/* implemented by the protocol */
+extern void A_init(void);
+extern void B_init(void);
+extern void A_input(struct pkt packet);
+extern void B_input(struct pkt packet);
+extern void A_output(struct msg message);
+extern void B_output(struct msg message);
+extern void A_timerinterrupt(void);
+extern void B_timerinterrupt(void);
+
+int TRACE = 1;               /* for my debugging */
+int window_full;             /* messages dropped because the sender's window was full */
+int total_ACKs_received;     /* uncorrupted ACKs received at A */
+int packets_resent;          /* packets resent by A after a timeout */
+int new_ACKs;                /* ACKs acknowledging packets not acknowledged before */
+int packets_received;        /* packets received intact at B */
+
+static struct sim *sim;      /* the simulation tolayer3() and friends act on */
+static const char *tracefile; /* where to save the binary trace, see -R */
+static const char *metrics;   /* how to print the connection's metrics, see -S */
+
+
+/********* the classic interface ************/
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  sim_tolayer3(sim, AorB, &packet);
+}
+
+void tolayer5(int AorB, char datasent[PAYLOADSIZE])
+{
+  sim_tolayer5(sim, AorB, datasent);
+}
+
+void starttimer(int AorB, float increment)
+{
+  sim_starttimer(sim, AorB, increment);
+}
+
+void stoptimer(int AorB)
+{
+  sim_stoptimer(sim, AorB);
+}
+
+double currenttime(void)
+{
+  return sim_time(sim);
+}
+
+/* a message was refused when the protocol counted it in window_full */
+static int global_output(void *proto, int AorB, struct msg message)
+{
+  int full = window_full;
+
+  (void)proto;
+  if (AorB == A)
+    A_output(message);
+  else
+    B_output(message);
+  return window_full == full ? 0 : -1;
+}
+
+static void global_input(void *proto, int AorB, struct pkt packet)
+{
+  (void)proto;
+  if (AorB == A)
+    A_input(packet);
+  else
+    B_input(packet);
+}
+
+static void global_timerinterrupt(void *proto, int AorB)
+{
+  (void)proto;
+  if (AorB == A)
+    A_timerinterrupt();
+  else
+    B_timerinterrupt();
+}
+
+static const struct sim_protocol global_protocol = {
+  global_output, global_input, global_timerinterrupt
+};
+
+
+/********* main ************/
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-n msgs] [-l loss] [-b burst] [-c corrupt] [-t interval] [-T trace]\n"
+         "          [-d delaymin:delaymean] [-D u|e|c] [-M u|e|c] [-f] [-2] [-s seed] [-m maxtime]\n"
+         "          [-R tracefile] [-S json|prometheus]\n"
+         "  -b  mean length of loss bursts       -D  delay distribution\n"
+         "  -M  message interarrival distribution -f  packets do not queue behind each other\n"
+         "  -2  bidirectional, B sends messages too\n"
+         "  -R  save the protocol's last events in tracefile, read it with sr_trace_decode\n"
+         "  -S  print the protocol's counters and histograms at the end\n", prog);
+}
+
+static int parse_dist(const char *arg, int *dist)
+{
+  switch (arg[0]) {
+  case 'u': *dist = SIM_UNIFORM; return 0;
+  case 'e': *dist = SIM_EXPONENTIAL; return 0;
+  case 'c': *dist = SIM_CONSTANT; return 0;
+  default: return -1;
+  }
+}
+
+static int parse_args(int argc, char **argv, struct sim_params *p)
+{
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+      return -1;
+    switch (argv[i][1]) {
+    case 'f': p->serialise = 0; continue;
+    case '2': p->bidirectional = 1; continue;
+    }
+    if (i + 1 >= argc)
+      return -1;
+    switch (argv[i++][1]) {
+    case 'n': p->nmsgs = atol(argv[i]); break;
+    case 'l': p->lossprob = atof(argv[i]); break;
+    case 'b': p->lossburst = atof(argv[i]); break;
+    case 'c': p->corruptprob = atof(argv[i]); break;
+    case 't': p->msginterval = atof(argv[i]); break;
+    case 'T': TRACE = atoi(argv[i]); break;
+    case 's': p->seed = strtoul(argv[i], NULL, 10); break;
+    case 'm': p->maxtime = atof(argv[i]); break;
+    case 'R': tracefile = argv[i]; break;
+    case 'S':
+      if (strcmp(argv[i], "json") != 0 && strcmp(argv[i], "prometheus") != 0)
+        return -1;
+      metrics = argv[i];
+      break;
+    case 'd':
+      if (sscanf(argv[i], "%lf:%lf", &p->delaymin, &p->delaymean) != 2)
+        return -1;
+      break;
+    case 'D':
+      if (parse_dist(argv[i], &p->delaydist) != 0)
+        return -1;
+      break;
+    case 'M':
+      if (parse_dist(argv[i], &p->msgdist) != 0)
+        return -1;
+      break;
+    default:
+      return -1;
+    }
+  }
+  if (p->nmsgs < 0 || p->msginterval <= 0 || p->lossprob < 0 || p->lossprob > 1
+      || p->corruptprob < 0 || p->corruptprob > 1 || p->delaymin < 0 || p->delaymean < p->delaymin)
+    return -1;
+  return 0;
+}
+
+/* the classic emulator's questions */
+static void ask(struct sim_params *p)
+{
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  if (scanf("%ld", &p->nmsgs) != 1)
+    exit(1);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  if (scanf("%lf", &p->lossprob) != 1)
+    exit(1);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  if (scanf("%lf", &p->corruptprob) != 1)
+    exit(1);
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  if (scanf("%lf", &p->msginterval) != 1)
+    exit(1);
+  printf("Enter TRACE:");
+  if (scanf("%d", &TRACE) != 1)
+    exit(1);
+  printf("Enter random seed: [>0]:");
+  if (scanf("%lu", &p->seed) != 1)
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  struct sim_params params;
+  const struct sim_stats *st;
+  int result;
+
+  sim_default_params(&params);
+  if (argc > 1) {
+    TRACE = 0;
+    if (parse_args(argc, argv, &params) != 0) {
+      usage(argv[0]);
+      return 2;
+    }
+  } else
+    ask(&params);
+  params.trace = TRACE;
+  if (tracefile != NULL && sr_trace_start(1u << 20) != 0) {
+    printf("emulator: cannot start tracing\n");
+    return 1;
+  }
+
+  sim = sim_create(&params, &global_protocol, NULL);
+  if (sim == NULL) {
+    printf("emulator: out of memory\n");
+    return 1;
+  }
+  A_init();
+  B_init();
+  result = sim_run(sim);
+  st = sim_stats(sim);
+
+  printf(" Simulator terminated at time %f\n after attempting to send %ld msgs from layer5\n",
+         st->endtime, st->generated);
+  printf("number of messages dropped due to full window:  %d\n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d\n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d\n", packets_resent);
+  printf("number of correct packets received at B:  %d\n", packets_received);
+  printf("number of messages delivered to application:  %ld\n", st->delivered);
+  printf("number of packets sent, lost, corrupted:  %ld %ld %ld\n", st->sent, st->lost, st->corrupted);
+  if (st->delivered > 0)
+    printf("mean and maximum message latency:  %f %f\n",
+           st->latency_sum / st->delivered, st->latency_max);
+  if (st->misdelivered > 0)
+    printf("number of messages delivered out of order or damaged:  %ld\n", st->misdelivered);
+  printf("events processed:  %ld\n", st->events);
+  if (metrics != NULL && strcmp(metrics, "json") == 0)
+    sr_metrics_json(stdout, "default", sr_conn_stats(sr_default_conn()), sr_conn_histograms(sr_default_conn()));
+  else if (metrics != NULL)
+    sr_metrics_prometheus(stdout, "default", sr_conn_stats(sr_default_conn()),
+                          sr_conn_histograms(sr_default_conn()));
+
+  if (tracefile != NULL) {
+    sr_trace_stop();
+    if (sr_trace_write(tracefile) != 0) {
+      printf("emulator: cannot write %s\n", tracefile);
+      result = -1;
+    }
+  }
+
+  sim_destroy(sim);
+  return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+/* ******************************************************************
+   Interface between the emulator (emulator.c) and the transport protocol.
+   Adapted from J.F.Kurose
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2
+
+   The protocol implements A_init(), A_output(), A_input(),
+   A_timerinterrupt(), B_init(), B_input() and, for bidirectional
+   transfer, B_output() and B_timerinterrupt().  The emulator provides
+   everything declared here.
+
+   currenttime() is not in the stock Kurose emulator.  sr.c reads it to
+   time its packets against one timer per side, so an emulator without it
+   needs the one line
+     double currenttime(void) { return time; }
+   returning the simulated clock its event loop already keeps.
+**********************************************************************/
+
+#define A    0
+#define B    1
+
+/* bytes of data in a message and in a packet.  The assignment uses 20;
+   build every file with, say, -DPAYLOADSIZE=1400 for packets the size of
+   an Ethernet MTU.  The selective ACKs in sr.c need at least 20. */
+#ifndef PAYLOADSIZE
+#define PAYLOADSIZE 20
+#endif
+
+/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
+/* 4 (students' code).  It contains the data (characters) to be delivered */
+/* to layer 5 via the students transport level protocol entities.         */
+struct msg {
+  char data[PAYLOADSIZE];
+};
+
+/* a packet is the data unit passed from layer 4 (students code) to layer */
+/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
+/* students must follow. */
+struct pkt {
+  int seqnum;
+  int acknum;
+  int checksum;
+  char payload[PAYLOADSIZE];
+};
+
+/* statistics the protocol updates, printed by the emulator at the end of a run */
+extern int TRACE;
+extern int window_full;
+extern int total_ACKs_received;
+extern int packets_resent;
+extern int new_ACKs;
+extern int packets_received;
+
+extern void starttimer(int AorB, float increment);
+extern void stoptimer(int AorB);
+extern double currenttime(void);   /* the simulated time starttimer() counts in */
+extern void tolayer3(int AorB, struct pkt packet);
+extern void tolayer5(int AorB, char datasent[PAYLOADSIZE]);
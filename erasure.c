@@ -0,0 +1,201 @@
+#include <stddef.h>
+#include <string.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SSSE3_PATH 1
+#endif
+#include "erasure.h"
+
+/* ******************************************************************
+   Reed-Solomon erasure code over GF(2^8).
+
+   The repair symbols are rows of a Cauchy matrix: repair j of k data
+   symbols is the sum over i of d_i / (x_j + y_i), with x_j = k + j and
+   y_i = i.  Every square submatrix of a Cauchy matrix is invertible, so
+   any e erased data symbols come back from any e repair symbols.
+
+   Multiplication is table driven.  gf256_muladd() picks its
+   implementation once, like the checksum kernels in checksum.c.
+**********************************************************************/
+
+#define GF_POLY 0x11d   /* x^8 + x^4 + x^3 + x^2 + 1, 2 generates the field */
+
+static unsigned char gf_exp[512];       /* doubled so gf_exp[log a + log b] needs no modulo */
+static unsigned char gf_log[256];
+static unsigned char gf_mul[256][256];  /* gf_mul[a][b] = a * b */
+static unsigned char gf_mulhi[256][16]; /* gf_mulhi[a][n] = a * (n << 4), with gf_mul[a][n] the pshufb tables */
+static void (*muladd_fn)(unsigned char *, unsigned char, const unsigned char *, size_t);
+
+static void gf_init_tables(void)
+{
+  int a, b;
+  int x = 1;
+
+  for (a = 0; a < 255; a++) {
+    gf_exp[a] = (unsigned char)x;
+    gf_log[x] = (unsigned char)a;
+    x <<= 1;
+    if (x & 0x100)
+      x ^= GF_POLY;
+  }
+  for (a = 255; a < 512; a++)
+    gf_exp[a] = gf_exp[a - 255];
+  for (a = 1; a < 256; a++)
+    for (b = 1; b < 256; b++)
+      gf_mul[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+  for (a = 0; a < 256; a++)
+    for (b = 0; b < 16; b++)
+      gf_mulhi[a][b] = gf_mul[a][b << 4];
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+  return gf_exp[255 - gf_log[a]];
+}
+
+static void muladd_table(unsigned char *dst, unsigned char c, const unsigned char *src, size_t len)
+{
+  const unsigned char *row = gf_mul[c];
+
+  while (len-- > 0)
+    *dst++ ^= row[*src++];
+}
+
+#ifdef HAVE_SSSE3_PATH
+/* c * b is c * (b & 15) ^ c * (b >> 4 << 4), two 16 entry lookups done by pshufb */
+__attribute__((target("ssse3")))
+static void muladd_ssse3(unsigned char *dst, unsigned char c, const unsigned char *src, size_t len)
+{
+  const __m128i lo = _mm_loadu_si128((const __m128i *)gf_mul[c]);
+  const __m128i hi = _mm_loadu_si128((const __m128i *)gf_mulhi[c]);
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i v, p;
+  size_t n = len & ~(size_t)15;
+  size_t i;
+
+  for (i = 0; i < n; i += 16) {
+    v = _mm_loadu_si128((const __m128i *)(src + i));
+    p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, mask)),
+                      _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), mask)));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(dst + i)), p));
+  }
+  muladd_table(dst + n, c, src + n, len - n);
+}
+#endif
+
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void erasure_select(void)
+{
+  gf_init_tables();
+  muladd_fn = muladd_table;
+#ifdef HAVE_SSSE3_PATH
+  if (__builtin_cpu_supports("ssse3"))
+    muladd_fn = muladd_ssse3;
+#endif
+}
+
+void gf256_muladd(unsigned char *dst, unsigned char c, const unsigned char *src, size_t len)
+{
+  if (muladd_fn == NULL)
+    erasure_select();
+  if (c != 0)
+    muladd_fn(dst, c, src, len);
+}
+
+const char *gf256_impl_name(void)
+{
+  if (muladd_fn == NULL)
+    erasure_select();
+#ifdef HAVE_SSSE3_PATH
+  if (muladd_fn == muladd_ssse3)
+    return "ssse3";
+#endif
+  return "table";
+}
+
+/* the coefficient of data symbol i in repair symbol index */
+static unsigned char cauchy(int k, int index, int i)
+{
+  return gf_inv((unsigned char)((k + index) ^ i));
+}
+
+void rs_encode(unsigned char *out, const unsigned char *const *data, int k, int index, size_t len)
+{
+  int i;
+
+  if (muladd_fn == NULL)
+    erasure_select();
+  memset(out, 0, len);
+  for (i = 0; i < k; i++)
+    gf256_muladd(out, cauchy(k, index, i), data[i], len);
+}
+
+int rs_decode(unsigned char *const *data, const char *present, int k,
+              const unsigned char *const *repair, const int *index, int nrepair, size_t len)
+{
+  unsigned char m[RS_MAXREPAIR][RS_MAXREPAIR];
+  int erased[RS_MAXREPAIR];
+  unsigned char f, t;
+  int e = 0;
+  int i, r, col, p;
+  size_t b;
+
+  if (muladd_fn == NULL)
+    erasure_select();
+  for (i = 0; i < k; i++)
+    if (!present[i]) {
+      if (e == RS_MAXREPAIR)
+        return -1;
+      erased[e++] = i;
+    }
+  if (e > nrepair)
+    return -1;
+
+  /* row r: repair r less the share of the data at hand, left in the buffer
+     of the r-th erased symbol, and its coefficients of the erased symbols */
+  for (r = 0; r < e; r++) {
+    memcpy(data[erased[r]], repair[r], len);
+    for (i = 0; i < k; i++)
+      if (present[i])
+        gf256_muladd(data[erased[r]], cauchy(k, index[r], i), data[i], len);
+    for (col = 0; col < e; col++)
+      m[r][col] = cauchy(k, index[r], erased[col]);
+  }
+
+  /* Gauss-Jordan elimination, the same row operations on the buffers,
+     until row r holds the erased symbol r itself */
+  for (col = 0; col < e; col++) {
+    for (p = col; p < e && m[p][col] == 0; p++)
+      ;
+    if (p == e)
+      return -1;   /* two repair symbols with the same index */
+    if (p != col) {
+      for (i = 0; i < e; i++) {
+        t = m[p][i];
+        m[p][i] = m[col][i];
+        m[col][i] = t;
+      }
+      for (b = 0; b < len; b++) {
+        t = data[erased[p]][b];
+        data[erased[p]][b] = data[erased[col]][b];
+        data[erased[col]][b] = t;
+      }
+    }
+    f = gf_inv(m[col][col]);
+    for (i = 0; i < e; i++)
+      m[col][i] = gf_mul[f][m[col][i]];
+    for (b = 0; b < len; b++)
+      data[erased[col]][b] = gf_mul[f][data[erased[col]][b]];
+    for (r = 0; r < e; r++) {
+      if (r == col || m[r][col] == 0)
+        continue;
+      f = m[r][col];
+      for (i = 0; i < e; i++)
+        m[r][i] ^= gf_mul[f][m[col][i]];
+      gf256_muladd(data[erased[r]], f, data[erased[col]], len);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,27 @@
+/* Reed-Solomon erasure code over GF(2^8) for the repair packets, see erasure.c */
+#include <stddef.h>
+
+/* a block holds at most RS_MAXSYMBOLS data and repair symbols together,
+   and at most RS_MAXREPAIR of its data symbols can be rebuilt at once */
+#define RS_MAXSYMBOLS 255
+#define RS_MAXREPAIR  32
+
+/* dst ^= c * src over len bytes in GF(2^8).  Uses SSSE3 when the CPU has
+   it, a full multiplication table otherwise, both give the same result. */
+extern void gf256_muladd(unsigned char *dst, unsigned char c, const unsigned char *src, size_t len);
+
+/* which gf256_muladd() implementation was picked for this CPU */
+extern const char *gf256_impl_name(void);
+
+/* repair symbol index of the k data symbols data[0..k-1], each len bytes,
+   into out.  The code is systematic: the data symbols go out as they are,
+   and any k of the data and repair symbols give back the data.  k + index
+   must be below 256. */
+extern void rs_encode(unsigned char *out, const unsigned char *const *data, int k, int index, size_t len);
+
+/* rebuild the data symbols whose present[i] is 0 into data[i], from the
+   others and the nrepair repair symbols repair[] with their indexes.
+   Returns -1 when there are more erasures than repair symbols, or more
+   than RS_MAXREPAIR. */
+extern int rs_decode(unsigned char *const *data, const char *present, int k,
+                     const unsigned char *const *repair, const int *index, int nrepair, size_t len);
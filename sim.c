@@ -0,0 +1,526 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "emulator.h"
+#include "sim.h"
+
+/* ******************************************************************
+   Discrete event core of the emulator.
+
+   Events wait in a binary heap ordered by time, ties broken by the
+   order they were scheduled in, so a run is reproducible from its seed
+   and costs O(log n) per event however many packets are in flight.
+
+   Channel model, as in the classic emulator unless configured otherwise:
+   - packets are delivered in the order they were sent in each direction
+   - a packet is lost with probability lossprob, optionally in bursts
+   - a packet is corrupted with probability corruptprob: the first
+     payload byte becomes 'z', or the seqnum or acknum becomes 999999
+**********************************************************************/
+
+#define EV_TIMER      0   /* a timer started with sim_starttimer() went off */
+#define EV_FROMLAYER5 1   /* layer 5 has a new message */
+#define EV_FROMLAYER3 2   /* a packet arrives */
+
+#define CORRUPTVALUE 999999   /* what a corrupted seqnum or acknum becomes */
+
+/* latencies are counted in buckets LATENCYSTEPS to a doubling, within 5%,
+   from 2^LATENCYMINEXP up to 2^(LATENCYMINEXP + LATENCYOCTAVES) time units */
+#define LATENCYSTEPS 16
+#define LATENCYMINEXP (-8)
+#define LATENCYOCTAVES 48
+#define LATENCYBUCKETS (LATENCYSTEPS * LATENCYOCTAVES)
+
+struct event {
+  double time;
+  unsigned long order;     /* scheduling order, first in first out among equal times */
+  int type;                /* EV_ */
+  int side;                /* the entity, A or B, the event happens at */
+  unsigned long timer;     /* for EV_TIMER, the start it belongs to, see struct timer */
+  struct pkt packet;       /* for EV_FROMLAYER3 */
+};
+
+/* stoptimer() does not search the heap, it bumps generation and the stale event is skipped */
+struct timer {
+  int running;
+  unsigned long generation;
+};
+
+/* a message on its way from layer 5 on one side to layer 5 on the other */
+struct pending {
+  long id;
+  double time;
+};
+
+/* messages in flight from one side, oldest first, grows as needed */
+struct pendingq {
+  struct pending *items;
+  long first, count, size;
+};
+
+struct sim {
+  struct sim_params params;
+  const struct sim_protocol *protocol;
+  void *proto;
+  struct sim_stats stats;
+
+  double time;
+  struct event *heap;
+  long nevents, heapsize;
+  unsigned long order;
+  uint64_t rng;
+
+  struct timer timers[2];
+  double lastarrival[2];       /* latest arrival scheduled at each side */
+  int inburst[2];              /* losing a run of packets towards each side */
+  long generated[2];           /* messages so far from each side's layer 5 */
+  struct pendingq pending[2];  /* accepted messages from each side not yet delivered */
+  long latency[LATENCYBUCKETS];
+  int failed;                  /* a heap or queue allocation failed */
+};
+
+
+/********* random numbers ************/
+
+/* splitmix64, small and fast, and every struct sim has its own */
+static uint64_t next_random(struct sim *s)
+{
+  uint64_t z;
+
+  s->rng += UINT64_C(0x9e3779b97f4a7c15);
+  z = s->rng;
+  z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return z ^ (z >> 31);
+}
+
+/* uniform on [0,1) */
+static double jimsrand(struct sim *s)
+{
+  return (double)(next_random(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double draw(struct sim *s, int dist, double mean)
+{
+  switch (dist) {
+  case SIM_EXPONENTIAL:
+    return -mean * log(1.0 - jimsrand(s));
+  case SIM_CONSTANT:
+    return mean;
+  default:
+    return 2.0 * mean * jimsrand(s);
+  }
+}
+
+
+/********* event queue ************/
+
+static int before(const struct event *x, const struct event *y)
+{
+  return x->time < y->time || (x->time == y->time && x->order < y->order);
+}
+
+static struct event *schedule(struct sim *s, double time, int type, int side)
+{
+  struct event *grown;
+  struct event e;
+  long i, parent;
+
+  if (s->nevents == s->heapsize) {
+    grown = realloc(s->heap, (s->heapsize ? 2 * s->heapsize : 64) * sizeof(struct event));
+    if (grown == NULL) {
+      s->failed = 1;
+      return NULL;
+    }
+    s->heap = grown;
+    s->heapsize = s->heapsize ? 2 * s->heapsize : 64;
+  }
+
+  e.time = time;
+  e.order = s->order++;
+  e.type = type;
+  e.side = side;
+  e.timer = 0;
+
+  /* sift up */
+  i = s->nevents++;
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!before(&e, &s->heap[parent]))
+      break;
+    s->heap[i] = s->heap[parent];
+    i = parent;
+  }
+  s->heap[i] = e;
+  return &s->heap[i];
+}
+
+static void next_event(struct sim *s, struct event *out)
+{
+  struct event last;
+  long i, child;
+
+  *out = s->heap[0];
+  last = s->heap[--s->nevents];
+
+  /* sift down */
+  i = 0;
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= s->nevents)
+      break;
+    if (child + 1 < s->nevents && before(&s->heap[child + 1], &s->heap[child]))
+      child++;
+    if (!before(&s->heap[child], &last))
+      break;
+    s->heap[i] = s->heap[child];
+    i = child;
+  }
+  s->heap[i] = last;
+}
+
+
+/********* layer 5 ************/
+
+static int latency_bucket(double latency)
+{
+  double mantissa;
+  int exponent, i;
+
+  if (latency < ldexp(1.0, LATENCYMINEXP))
+    return 0;
+  mantissa = frexp(latency, &exponent);   /* latency = mantissa * 2^exponent, mantissa in [0.5, 1) */
+  i = (exponent - 1 - LATENCYMINEXP) * LATENCYSTEPS + (int)((mantissa - 0.5) * 2 * LATENCYSTEPS);
+  return i < LATENCYBUCKETS ? i : LATENCYBUCKETS - 1;
+}
+
+/* the largest latency that falls in bucket i */
+static double latency_bound(int i)
+{
+  return ldexp(1.0 + (double)(i % LATENCYSTEPS + 1) / LATENCYSTEPS,
+               i / LATENCYSTEPS + LATENCYMINEXP);
+}
+
+/* the data of message id, its number then a letter repeated so a mixup is easy to spot */
+static void make_message(long id, char *data)
+{
+  char digits[24];
+  int n;
+
+  memset(data, 'a' + (int)(id % 26), PAYLOADSIZE);
+  n = sprintf(digits, "%ld", id);
+  memcpy(data, digits, n < PAYLOADSIZE ? n : PAYLOADSIZE);
+}
+
+static int pending_push(struct sim *s, struct pendingq *q, long id)
+{
+  struct pending *grown;
+  long i, size;
+
+  if (q->count == q->size) {
+    size = q->size ? 2 * q->size : 64;
+    grown = malloc(size * sizeof(struct pending));
+    if (grown == NULL) {
+      s->failed = 1;
+      return -1;
+    }
+    for (i = 0; i < q->count; i++)
+      grown[i] = q->items[(q->first + i) % q->size];
+    free(q->items);
+    q->items = grown;
+    q->first = 0;
+    q->size = size;
+  }
+  q->items[(q->first + q->count) % q->size].id = id;
+  q->items[(q->first + q->count) % q->size].time = s->time;
+  q->count++;
+  return 0;
+}
+
+static void from_layer5(struct sim *s, int side)
+{
+  struct msg message;
+  long id = s->generated[side]++;
+
+  s->stats.generated++;
+  make_message(id, message.data);
+  if (s->params.trace > 2)
+    printf("          GENERATE NEXT ARRIVAL: creating new arrival at %c\n", side == A ? 'A' : 'B');
+
+  if (s->protocol->output(s->proto, side, message) == 0)
+    pending_push(s, &s->pending[side], id);
+  else
+    s->stats.dropped++;
+
+  if (s->generated[side] < s->params.nmsgs)
+    schedule(s, s->time + draw(s, s->params.msgdist, s->params.msginterval), EV_FROMLAYER5, side);
+}
+
+void sim_tolayer5(struct sim *s, int AorB, const char *data)
+{
+  struct pendingq *q = &s->pending[1 - AorB];
+  char expected[PAYLOADSIZE];
+  struct pending *head;
+  double latency;
+
+  if (s->params.trace > 2)
+    printf("          TOLAYER5: data received: %.20s\n", data);
+
+  /* each side's messages must arrive in the order they were accepted */
+  if (q->count == 0) {
+    s->stats.misdelivered++;
+    return;
+  }
+  head = &q->items[q->first];
+  make_message(head->id, expected);
+  if (memcmp(expected, data, PAYLOADSIZE) != 0) {
+    if (s->params.trace > 0)
+      printf("          TOLAYER5: expected message %ld, got %.20s\n", head->id, data);
+    s->stats.misdelivered++;
+    return;
+  }
+
+  latency = s->time - head->time;
+  s->stats.latency_sum += latency;
+  if (latency > s->stats.latency_max)
+    s->stats.latency_max = latency;
+  s->latency[latency_bucket(latency)]++;
+  s->stats.delivered++;
+  q->first = (q->first + 1) % q->size;
+  q->count--;
+}
+
+
+/********* layer 3 ************/
+
+/* Bernoulli losses, or a two state (Gilbert) channel when lossburst > 1:
+   a burst ends with probability 1/lossburst per packet and starts with the
+   probability that keeps the long run loss rate at lossprob */
+static int lose(struct sim *s, int side)
+{
+  double p = s->params.lossprob;
+  double end;
+
+  if (s->params.lossburst <= 1.0)
+    return jimsrand(s) < p;
+  end = 1.0 / s->params.lossburst;
+  if (s->inburst[side])
+    s->inburst[side] = jimsrand(s) >= end;
+  else if (p < 1.0)
+    s->inburst[side] = jimsrand(s) < p * end / (1.0 - p);
+  else
+    s->inburst[side] = 1;
+  return s->inburst[side];
+}
+
+void sim_tolayer3(struct sim *s, int AorB, const struct pkt *packet)
+{
+  struct event *e;
+  int to = 1 - AorB;
+  double delay, arrival;
+  double x;
+
+  s->stats.sent++;
+
+  /* simulate losses */
+  if (lose(s, to)) {
+    s->stats.lost++;
+    if (s->params.trace > 0)
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }
+
+  /* packets arrive in the order they were sent, serialised ones also wait for the one before */
+  delay = s->params.delaymin + draw(s, s->params.delaydist, s->params.delaymean - s->params.delaymin);
+  if (s->params.serialise)
+    arrival = (s->lastarrival[to] > s->time ? s->lastarrival[to] : s->time) + delay;
+  else
+    arrival = s->time + delay > s->lastarrival[to] ? s->time + delay : s->lastarrival[to];
+  s->lastarrival[to] = arrival;
+
+  e = schedule(s, arrival, EV_FROMLAYER3, to);
+  if (e == NULL)
+    return;
+  e->packet = *packet;
+
+  /* simulate corruption */
+  if (jimsrand(s) < s->params.corruptprob) {
+    s->stats.corrupted++;
+    x = jimsrand(s);
+    if (x < .75)
+      e->packet.payload[0] = 'z';
+    else if (x < .875)
+      e->packet.seqnum = CORRUPTVALUE;
+    else
+      e->packet.acknum = CORRUPTVALUE;
+    if (s->params.trace > 0)
+      printf("          TOLAYER3: packet being corrupted\n");
+  }
+
+  if (s->params.trace > 2)
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d %.20s\n",
+           packet->seqnum, packet->acknum, packet->checksum, packet->payload);
+}
+
+
+/********* timers ************/
+
+void sim_starttimer(struct sim *s, int AorB, float increment)
+{
+  struct timer *t = &s->timers[AorB];
+  struct event *e;
+
+  if (s->params.trace > 2)
+    printf("          START TIMER: starting timer at %f\n", s->time);
+  if (t->running) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  e = schedule(s, s->time + increment, EV_TIMER, AorB);
+  if (e == NULL)
+    return;
+  t->running = 1;
+  e->timer = ++t->generation;
+}
+
+void sim_stoptimer(struct sim *s, int AorB)
+{
+  struct timer *t = &s->timers[AorB];
+
+  if (s->params.trace > 2)
+    printf("          STOP TIMER: stopping timer at %f\n", s->time);
+  if (!t->running) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  t->running = 0;
+  t->generation++;
+}
+
+
+/********* running ************/
+
+void sim_default_params(struct sim_params *p)
+{
+  p->nmsgs = 1000;
+  p->msginterval = 10.0;
+  p->msgdist = SIM_UNIFORM;
+  p->lossprob = 0.0;
+  p->lossburst = 1.0;
+  p->corruptprob = 0.0;
+  p->delaymin = 1.0;
+  p->delaymean = 5.5;
+  p->delaydist = SIM_UNIFORM;
+  p->serialise = 1;
+  p->bidirectional = 0;
+  p->seed = 9999;
+  p->maxtime = 0.0;
+  p->trace = 0;
+}
+
+struct sim *sim_create(const struct sim_params *params, const struct sim_protocol *protocol, void *proto)
+{
+  struct sim *s;
+
+  s = calloc(1, sizeof(struct sim));
+  if (s == NULL)
+    return NULL;
+  s->params = *params;
+  s->protocol = protocol;
+  s->proto = proto;
+  s->rng = params->seed;
+  return s;
+}
+
+void sim_destroy(struct sim *s)
+{
+  if (s == NULL)
+    return;
+  free(s->heap);
+  free(s->pending[A].items);
+  free(s->pending[B].items);
+  free(s);
+}
+
+int sim_run(struct sim *s)
+{
+  struct event e;
+  struct timer *t;
+
+  if (s->params.nmsgs > 0) {
+    schedule(s, draw(s, s->params.msgdist, s->params.msginterval), EV_FROMLAYER5, A);
+    if (s->params.bidirectional)
+      schedule(s, draw(s, s->params.msgdist, s->params.msginterval), EV_FROMLAYER5, B);
+  }
+
+  while (s->nevents > 0 && !s->failed) {
+    next_event(s, &e);
+    if (s->params.maxtime > 0 && e.time > s->params.maxtime)
+      break;
+    s->time = e.time;
+
+    switch (e.type) {
+    case EV_TIMER:
+      /* skip timers stopped or restarted since this event was scheduled */
+      t = &s->timers[e.side];
+      if (!t->running || t->generation != e.timer)
+        continue;
+      t->running = 0;
+      if (s->params.trace > 1)
+        printf("\nEVENT time: %f,  type: %d, timerinterrupt  entity: %d\n", s->time, e.type, e.side);
+      s->protocol->timerinterrupt(s->proto, e.side);
+      break;
+    case EV_FROMLAYER5:
+      if (s->params.trace > 1)
+        printf("\nEVENT time: %f,  type: %d, fromlayer5  entity: %d\n", s->time, e.type, e.side);
+      from_layer5(s, e.side);
+      break;
+    default:
+      if (s->params.trace > 1)
+        printf("\nEVENT time: %f,  type: %d, fromlayer3  entity: %d\n", s->time, e.type, e.side);
+      s->protocol->input(s->proto, e.side, e.packet);
+      break;
+    }
+    s->stats.events++;
+  }
+
+  s->stats.endtime = s->time;
+  if (s->failed) {
+    fprintf(stderr, "sim: out of memory\n");
+    return -1;
+  }
+  return (s->stats.misdelivered == 0 && s->pending[A].count == 0 && s->pending[B].count == 0) ? 0 : -1;
+}
+
+const struct sim_stats *sim_stats(const struct sim *s)
+{
+  return &s->stats;
+}
+
+double sim_time(const struct sim *s)
+{
+  return s->time;
+}
+
+double sim_latency_percentile(const struct sim *s, double q)
+{
+  long target, seen = 0;
+  int i;
+
+  if (s->stats.delivered == 0)
+    return 0.0;
+  target = (long)ceil(q * s->stats.delivered);
+  if (target < 1)
+    target = 1;
+  for (i = 0; i < LATENCYBUCKETS; i++) {
+    seen += s->latency[i];
+    if (seen >= target)
+      break;
+  }
+  /* the bucket bound can overshoot the worst latency actually seen */
+  if (i >= LATENCYBUCKETS || latency_bound(i) > s->stats.latency_max)
+    return s->stats.latency_max;
+  return latency_bound(i);
+}
@@ -0,0 +1,71 @@
+/* Discrete event core of the emulator, include after emulator.h.
+
+   A struct sim is one simulated channel between entities A and B with
+   its own event queue, random number generator and statistics, so any
+   number of them can run side by side, one per thread.  emulator.c runs
+   one through the classic global interface; other drivers hand the
+   protocol their own callbacks and call the sim_ lower layer functions
+   from them. */
+
+struct sim;
+
+/* distributions for message interarrival times and channel delays */
+#define SIM_UNIFORM     0   /* uniform with the given mean, the classic emulator's choice */
+#define SIM_EXPONENTIAL 1   /* exponential with the given mean */
+#define SIM_CONSTANT    2   /* always the mean */
+
+struct sim_params {
+  long nmsgs;              /* messages layer 5 hands to A, and to B when bidirectional */
+  double msginterval;      /* mean time between messages from layer 5 */
+  int msgdist;             /* SIM_ distribution of the time between messages */
+  double lossprob;         /* probability a packet is lost */
+  double lossburst;        /* mean length of a run of losses, 1 or less = independent losses */
+  double corruptprob;      /* probability a packet is corrupted */
+  double delaymin;         /* shortest one way channel delay */
+  double delaymean;        /* mean one way channel delay */
+  int delaydist;           /* SIM_ distribution of the delay above delaymin */
+  int serialise;           /* 1 = a packet is not sent before the previous one arrived, as in the classic emulator */
+  int bidirectional;       /* 1 = layer 5 at B sends messages too */
+  unsigned long seed;      /* runs with the same parameters and seed are identical */
+  double maxtime;          /* stop at this time, 0 = when no events are left */
+  int trace;               /* like TRACE, for the emulator's own messages */
+};
+
+/* fills in the classic emulator's defaults */
+extern void sim_default_params(struct sim_params *params);
+
+/* how the emulator reaches the protocol entities */
+struct sim_protocol {
+  int (*output)(void *proto, int AorB, struct msg message);   /* 0 = accepted, -1 = dropped */
+  void (*input)(void *proto, int AorB, struct pkt packet);
+  void (*timerinterrupt)(void *proto, int AorB);
+};
+
+struct sim_stats {
+  long generated;          /* messages from layer 5 */
+  long dropped;            /* messages the protocol refused */
+  long delivered;          /* messages passed up to layer 5 */
+  long misdelivered;       /* deliveries out of order, duplicated or with the wrong data */
+  long sent;               /* packets passed to layer 3 */
+  long lost;
+  long corrupted;
+  long events;             /* events processed */
+  double latency_sum;      /* from layer 5 at the sender to layer 5 at the receiver */
+  double latency_max;
+  double endtime;
+};
+
+extern struct sim *sim_create(const struct sim_params *params, const struct sim_protocol *protocol, void *proto);
+extern void sim_destroy(struct sim *sim);
+/* runs to the end, returns 0 when every accepted message arrived intact, once and in order */
+extern int sim_run(struct sim *sim);
+extern const struct sim_stats *sim_stats(const struct sim *sim);
+extern double sim_time(const struct sim *sim);
+/* latency below which a fraction q of the delivered messages arrived, within 5% */
+extern double sim_latency_percentile(const struct sim *sim, double q);
+
+/* the lower layer of a sim, what tolayer3() and friends are for the classic emulator */
+extern void sim_tolayer3(struct sim *sim, int AorB, const struct pkt *packet);
+extern void sim_tolayer5(struct sim *sim, int AorB, const char *data);
+extern void sim_starttimer(struct sim *sim, int AorB, float increment);
+extern void sim_stoptimer(struct sim *sim, int AorB);
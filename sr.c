@@ -1,8 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
 #include "sr.h"
+#include "checksum.h"
+#include "erasure.h"
+#include "sr_trace.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -20,382 +24,1826 @@
    - removed bidirectional GBN code and other code not used by prac. 
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - all state lives in a struct sr_conn so one process can run many
+     connections, the A_ and B_ functions drive a default connection
+   - in bidirectional mode both ends send and receive, and data packets
+     carry the cumulative ACK for the other direction
+   - in fragment mode sr_send() takes messages of any size and the
+     receiver reassembles them, PAYLOADSIZE sets the packet size
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 13      /* the min sequence space for GBN must be at least windowsize + 1 */
+#define WINDOWSIZE 6    /* default maximum number of buffered unacked packet, see sr_configure() */
+#define SEQSPACE 13      /* default sequence space, for SR it must be at least 2 * windowsize */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define MINTIMEOUT 8    /* lower bound in ticks for the adaptive retransmission timeout, above round trip jitter */
+#define MAXTIMEOUT 4096 /* upper bound in ticks, large windows queue for a long time */
+#define MAXSEQSPACE 0x80000000u /* seqnums from 2^31 on read as NOTINUSE, FECPARITY and RSREPAIR */
+#define BATCH 64        /* packets output_batch() and input_batch() handle at once */
+
+/* B's ACKs carry a selective ACK in their otherwise unused payload:
+   payload[0] is SACKMARK, payload[1..4] the cumulative ACK (the next sequence
+   number B expects, little endian) and bit i of payload[5..] is set when
+   B holds the packet i + 1 after the cumulative ACK. */
+#define SACKMARK 'S'
+#define SACKCUM 1       /* offset of the cumulative ACK in the payload */
+#define SACKMAP 5       /* offset of the bitmap in the payload */
+#define SACKBITS ((PAYLOADSIZE - SACKMAP) * 8)
+#if PAYLOADSIZE < 20
+#error "PAYLOADSIZE below 20 leaves too little room for the selective ACK"
+#endif
+
+/* With config.fec, every fec new packets are followed by a parity packet:
+   seqnum FECPARITY, acknum the first packet of the group and the XOR of
+   the group's payloads as payload.  A receiver missing one packet of the
+   group rebuilds it from the parity and the others, see repair(). */
+#define FECPARITY (-2)
+
+/* With config.rsrepair, packets timing out for the first time are not
+   resent.  Reed-Solomon repair packets over the whole window go instead,
+   config.rsrepair more than the packets timing out: seqnum RSREPAIR -
+   (index << 8 | n), acknum the first of the n packets in the window and
+   the repair symbol as payload, see erasure.h.  A receiver missing e
+   packets of the window decodes them from any e repair packets, see
+   rs_receive(). */
+#define RSREPAIR (-3)
+
+/* With config.fragment, the first SR_FRAGHEADER bytes of a message are
+   flags, FRAGLAST on the last fragment of a message, then the number of
+   message bytes that follow, little endian.  The rest of the payload is
+   zero. */
+#define FRAGLAST 0x01
+#if SR_FRAGDATA > 0xffff
+#error "PAYLOADSIZE is too large for the two byte fragment length"
+#endif
+
+/* TRACING(n) is true when TRACE is at least n, messages above SR_TRACE_LEVEL
+   are compiled out.  Release builds use -DSR_TRACE_LEVEL=0 so the data path has
+   no trace branches, printf calls or format strings; by default all are kept. */
+#ifndef SR_TRACE_LEVEL
+#define SR_TRACE_LEVEL 3
+#endif
+#define TRACING(level) ((level) <= SR_TRACE_LEVEL && TRACE >= (level))
+
+/* binary trace event, see sr_trace.h.  Recording is a few stores into a
+   per-thread ring, cheap enough to leave enabled on the data path. */
+#define EVENT(c, type, side, seq, aux) \
+  do { \
+    if (atomic_load_explicit(&sr_trace_enabled, memory_order_relaxed)) \
+      sr_trace_record((c)->traceid, (type), (side), (uint32_t)(seq), \
+                      (uint32_t)(c)->sender[(side)].current_tick, (aux)); \
+  } while (0)
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
+   Packets are passed by pointer, a copy of a large PAYLOADSIZE costs more than the sum.
 */
-int ComputeChecksum(struct pkt packet)
+int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
+  unsigned int checksum = 0;
+
+  /* summed unsigned, seqnums up to 2^31 - 1 would overflow an int */
+  checksum = (unsigned int)packet->seqnum;
+  checksum += (unsigned int)packet->acknum;
+  checksum += (unsigned int)sum_bytes(packet->payload, PAYLOADSIZE);
+
+  return (int)checksum;
+}
+
+/* CRC32C over the same fields, also catches the swapped and multi bit errors
+   an additive sum misses.  The header is serialised little endian so both
+   ends agree whatever the host byte order. */
+int ComputeCRC32C(const struct pkt *packet)
+{
+  unsigned char header[8];
+  uint32_t crc;
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
+  for ( i=0; i<4; i++ ) {
+    header[i] = (unsigned char)((unsigned int)packet->seqnum >> (8 * i));
+    header[4 + i] = (unsigned char)((unsigned int)packet->acknum >> (8 * i));
+  }
+  crc = crc32c(0, header, sizeof(header));
+  crc = crc32c(crc, packet->payload, PAYLOADSIZE);
+
+  return (int)crc;
+}
 
-  return checksum;
+/* checksum of a packet under the connection's SR_CHECKSUM_ mode */
+int PacketChecksum(int mode, const struct pkt *packet)
+{
+  if (mode == SR_CHECKSUM_CRC32C)
+    return ComputeCRC32C(packet);
+  return ComputeChecksum(packet);
 }
 
-bool IsCorrupted(struct pkt packet)
+bool IsCorrupted(int mode, const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == PacketChecksum(mode, packet))
     return (false);
   else
     return (true);
 }
 
+
+/********* Connection state ************/
+
+/* Sender side: per packet arrays hold one slot per window position, see send_slot() */
+struct sr_sender {
+  struct pkt *buffer;           /* array for storing packets waiting for ACK */
+  bool *acked;                  /* tracks if packets have been acked */
+  int *due_tick;                /*This tracks 'expiry' times*/
+  int *sent_tick;               /* tick each packet was first sent, for RTT samples */
+  int *retries;                 /* timeouts so far for each packet, for Karn's rule and repair */
+  int current_tick;             /* the clock in ticks, read from ops->now on every entry */
+  int next_due_tick;            /* earliest entry in due_tick[], no need to scan before it */
+  /*initial timeout period (RTT * 1.5 = 24), adapted from ACK round trip samples after that*/
+  int timeout_ticks;            /*ticks before timeout (24/1.0 = 24)*/
+  float srtt;                   /* smoothed round trip time in ticks */
+  float rttvar;                 /* round trip time variation in ticks */
+  bool have_rtt_sample;         /* no RTT sample taken yet */
+  int backoff_tick;             /* timeouts before this tick were armed before the last backoff */
+  int backoff_start;            /* tick of the last backoff, -1 once a sample has ended it */
+  int timer_running;
+  int timer_due;                /* the tick the running timer goes off at */
+
+  unsigned int windowfirst;     /* sequence number of the first packet awaiting ACK */
+  int firstslot;                /* the slot holding windowfirst */
+  int windowcount;              /* the number of packets currently awaiting an ACK */
+  unsigned int nextseqnum;      /* the next sequence number to be used by the sender */
+
+  struct msg *backlog;          /* ring of config.backlog messages waiting for the window */
+  int backlogfirst;             /* the oldest waiting message */
+  int backlogcount;             /* the number of messages waiting */
+
+  char fecparity[PAYLOADSIZE];           /* XOR of the payloads of the parity group so far */
+  unsigned int fecfirst;        /* the first sequence number of the group */
+  int feccount;                 /* the number of packets in the group so far */
+
+  unsigned int rsfirst;         /* the window repair packets were last sent over, */
+  int rsblock;                  /* its first packet and size */
+  int rsnext;                   /* the next repair symbol index for that window */
+};
+
+/* Receiver side: one slot per window position starting at expectedseqnum, see recv_slot() */
+struct sr_receiver {
+  struct pkt *buffer;
+  int *received;
+  unsigned int expectedseqnum;  /* the sequence number expected next by the receiver */
+  int firstslot;                /* the slot of buffer[] holding expectedseqnum */
+  bool anydelivered;            /* something was delivered, so recv_lastack() is a real ACK */
+  int ackpending;               /* in order arrivals not ACKed yet, see config.ackdelay */
+  unsigned int lastseq;         /* the latest of them, acknum of the coalesced ACK */
+  int ackdue;                   /* the tick of this end's clock the delayed ACK is due */
+
+  struct pkt *rsbuffer;         /* RS_MAXREPAIR repair packets of the block from rsfirst */
+  unsigned int rsfirst;         /* the first packet of that block */
+  int rsblock;                  /* the number of packets in it */
+  int rscount;                  /* the number of repair packets held */
+
+  char *message;                /* the fragments of the message being reassembled, */
+  size_t messagelen;            /* its length so far */
+  size_t messagecap;            /* and the space allocated for it */
+  bool messagelost;             /* out of memory, drop the rest of the message */
+};
+
+/* Both ends have a sender and a receiver, indexed by A and B.  A's sender
+   and B's receiver carry the A to B traffic, B's sender and A's receiver
+   are only used in bidirectional mode.
+
+   On the wire a packet with a seqnum carries data, and its acknum is
+   either NOTINUSE or the cumulative ACK of the sending end's receiver:
+   every packet up to and including acknum has arrived.  A bare ACK has
+   seqnum NOTINUSE, acknum the packet it acknowledges and the selective
+   ACK in its payload. */
+struct sr_conn {
+  struct sr_config config;
+  const struct sr_ops *ops;     /* lower layer and timers for this connection */
+  void *user;                   /* passed back to every ops call */
+  struct sr_stats stats;
+  struct sr_histograms hist;
+  uint32_t traceid;             /* tags this connection's trace events */
+
+  struct sr_sender sender[2];
+  struct sr_receiver receiver[2];
+};
+
+static float tick_interval = 1.0;      /* the length of a tick, deadlines are kept in whole ticks */
+
+/* count value in h, see struct sr_histogram.  Values are shifted down to
+   their top SR_HIST_SUBBITS + 1 bits, the shift picks the power of two. */
+static void hist_record(struct sr_histogram *h, unsigned long value)
+{
+  unsigned long v = value;
+  unsigned long i;
+  int shift = 0;
+
+  while (v >= 2 * SR_HIST_SUB) {
+    v >>= 1;
+    shift++;
+  }
+  i = (unsigned long)shift * SR_HIST_SUB + v;
+  h->buckets[i < SR_HIST_BUCKETS ? i : SR_HIST_BUCKETS - 1]++;
+  h->count++;
+  h->sum += value;
+  if (value > h->max)
+    h->max = value;
+}
+
+/* serial number arithmetic (RFC 1982) modulo config.seqspace */
+static unsigned int seq_add(const struct sr_conn *c, unsigned int seq, unsigned int n)
+{
+  unsigned int space = c->config.seqspace;
+
+  n %= space;
+  return (seq >= space - n) ? seq - (space - n) : seq + n;
+}
+
+/* how far seqnum is ahead of base */
+static unsigned int seq_diff(const struct sr_conn *c, unsigned int base, unsigned int seqnum)
+{
+  if (seqnum >= base)
+    return seqnum - base;
+  return seqnum + (c->config.seqspace - base);
+}
+
 /* This function covers wrap around logic so old ACKs don't get misinterpreted*/
-bool isInWindow(int base, int seqnum) {
-    if (base <= (base + WINDOWSIZE - 1) % SEQSPACE) {
-        /* no wraparound*/ 
-        return seqnum >= base && seqnum < base + WINDOWSIZE;
-    } else {
-        /* wraparound */
-        return seqnum >= base || seqnum < (base + WINDOWSIZE) % SEQSPACE;
+static bool isInWindow(const struct sr_conn *c, unsigned int base, unsigned int seqnum) {
+    return seq_diff(c, base, seqnum) < (unsigned int)c->config.windowsize;
+}
+
+static bool valid_config(const struct sr_config *config)
+{
+  if (config->windowsize < 1
+      || (config->seqspace != 0 && config->seqspace / 2 < (unsigned int)config->windowsize)) {
+    fprintf(stderr, "sr: window %d does not fit sequence space %u\n", config->windowsize, config->seqspace);
+    return false;
+  }
+  if (config->checksum != SR_CHECKSUM_SUM && config->checksum != SR_CHECKSUM_CRC32C) {
+    fprintf(stderr, "sr: unknown checksum mode %d\n", config->checksum);
+    return false;
+  }
+  if (config->timeout < 0 || config->timeout > MAXTIMEOUT) {
+    fprintf(stderr, "sr: initial timeout %d is not within 0..%d ticks\n", config->timeout, MAXTIMEOUT);
+    return false;
+  }
+  if (config->backlog < 0) {
+    fprintf(stderr, "sr: backlog %d must not be negative\n", config->backlog);
+    return false;
+  }
+  if (config->ackdelay < 0 || config->ackevery < 0) {
+    fprintf(stderr, "sr: ACK delay %d and ACK count %d must not be negative\n",
+            config->ackdelay, config->ackevery);
+    return false;
+  }
+  if (config->fec < 0 || config->fec > config->windowsize) {
+    fprintf(stderr, "sr: FEC group %d is not within 0..window %d\n", config->fec, config->windowsize);
+    return false;
+  }
+  if (config->rsrepair < 0 || config->rsrepair > RS_MAXREPAIR
+      || (config->rsrepair > 0 && config->windowsize + RS_MAXREPAIR > RS_MAXSYMBOLS)) {
+    fprintf(stderr, "sr: %d repair packets are not within 0..%d, or window %d is above %d for them\n",
+            config->rsrepair, RS_MAXREPAIR, config->windowsize, RS_MAXSYMBOLS - RS_MAXREPAIR);
+    return false;
+  }
+  /* both ends tell data from ACKs, parity and repair packets by the sign of seqnum,
+     whichever way the data goes */
+  if (config->seqspace > MAXSEQSPACE) {
+    fprintf(stderr, "sr: sequence space %u is above 2^31\n", config->seqspace);
+    return false;
+  }
+  if (config->fragment != 0 && config->fragment != 1) {
+    fprintf(stderr, "sr: fragment %d must be 0 or 1\n", config->fragment);
+    return false;
+  }
+  return true;
+}
+
+/* buffers are sized by the window, not the sequence space, so allocate them at init time */
+static void *alloc_window(const struct sr_conn *c, void *old, size_t size)
+{
+  free(old);
+  return calloc(c->config.windowsize, size);
+}
+
+static char side_name(int side)
+{
+  return side == A ? 'A' : 'B';
+}
+
+/* side's clock in whole ticks of the lower layer's time.  Read on every
+   entry, so the timer need only go off when something is due. */
+static void read_clock(struct sr_conn *c, int side)
+{
+  c->sender[side].current_tick = (int)(c->ops->now(c->user) / tick_interval);
+}
+
+/* run side's one timer to its earliest deadline: the first packet due or the
+   held ACK.  A timer already set for that deadline or earlier is left alone,
+   going off early only means tick() finds less to do.  Stopped when there is
+   nothing to wait for. */
+static void arm_timer(struct sr_conn *c, int side)
+{
+  struct sr_sender *s = &c->sender[side];
+  struct sr_receiver *r = &c->receiver[side];
+  int due;
+
+  if (s->windowcount == 0 && r->ackpending == 0) {
+    if (s->timer_running) {
+      c->ops->stoptimer(c->user, side);
+      s->timer_running = 0;
     }
+    return;
+  }
+  due = s->windowcount > 0 ? s->next_due_tick : r->ackdue;
+  if (r->ackpending > 0 && r->ackdue < due)
+    due = r->ackdue;
+  if (due <= s->current_tick)
+    due = s->current_tick + 1;
+  if (s->timer_running) {
+    if (s->timer_due <= due)
+      return;
+    c->ops->stoptimer(c->user, side);
+  }
+  c->ops->starttimer(c->user, side, (float)(due * tick_interval - c->ops->now(c->user)));
+  s->timer_running = 1;
+  s->timer_due = due;
+}
+
+
+/********* Sender procedures, A's and in bidirectional mode B's ************/
+
+static bool sender_init(struct sr_conn *c, int side)
+{
+  struct sr_sender *s = &c->sender[side];
+  int i;
+
+  /* initialise the window, buffer and sequence number */
+  s->nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  s->windowfirst = 0;
+  s->firstslot = 0;   /* new packets are placed in the slot windowcount after firstslot */
+  s->windowcount = 0;
+  s->current_tick = 0;
+  s->timer_running = 0;
+  s->timer_due = 0;
+  s->timeout_ticks = c->config.timeout > 0 ? c->config.timeout : 24;
+  s->have_rtt_sample = false;
+  s->backoff_tick = 0;
+  s->backoff_start = -1;
+  s->buffer = alloc_window(c, s->buffer, sizeof(struct pkt));
+  s->acked = alloc_window(c, s->acked, sizeof(bool));
+  s->due_tick = alloc_window(c, s->due_tick, sizeof(int));
+  s->sent_tick = alloc_window(c, s->sent_tick, sizeof(int));
+  s->retries = alloc_window(c, s->retries, sizeof(int));
+  s->backlogfirst = 0;
+  s->backlogcount = 0;
+  s->feccount = 0;
+  s->rsblock = 0;
+  s->rsnext = 0;
+  for (i = 0; i < PAYLOADSIZE; i++)
+    s->fecparity[i] = 0;
+  free(s->backlog);
+  s->backlog = NULL;
+  if (c->config.backlog > 0)
+    s->backlog = calloc(c->config.backlog, sizeof(struct msg));
+  return s->buffer && s->acked && s->due_tick && s->sent_tick && s->retries
+         && (c->config.backlog == 0 || s->backlog);
+}
+
+/* slot of an outstanding sequence number in a sender's per packet arrays */
+static int send_slot(const struct sr_conn *c, const struct sr_sender *s, unsigned int seqnum)
+{
+  return (int)((s->firstslot + seq_diff(c, s->windowfirst, seqnum)) % c->config.windowsize);
 }
 
+/* true while seqnum is sent and its slot still in the sender's window */
+static bool outstanding(const struct sr_conn *c, const struct sr_sender *s, unsigned int seqnum)
+{
+  return seq_diff(c, s->windowfirst, seqnum) < (unsigned int)s->windowcount;
+}
 
-/********* Sender (A) variables and functions ************/
+/* the packet in slot has been acknowledged, by its own ACK or a cumulative or selective one */
+static void ack_slot(struct sr_conn *c, int side, int slot)
+{
+  struct sr_sender *s = &c->sender[side];
 
-static struct pkt buffer[SEQSPACE];  /* array for storing packets waiting for ACK (seqspace for sr)*/
-static bool acked[SEQSPACE];         /* tracks if packets have been acked */
-static int current_tick = 0;         /*  This will be the global clock */
-static int due_tick[SEQSPACE];       /*This tracks 'expiry' times*/
-/*timeout period (RTT * 1.5 = 24)*/
-static int timeout_ticks = 24;         /*ticks before timeout (24/1.0 = 24)*/
-/*static float tick_interval = 1;      this is how often to call timer_interrupt*/
-int timer_running = 0;
+  s->acked[slot] = 1;
+  c->stats.packets_acked++;
+  hist_record(&c->hist.ack_latency, (unsigned long)(s->current_tick - s->sent_tick[slot]));
+}
 
-static struct pkt B_buffer[SEQSPACE]; 
-static int B_received[SEQSPACE]; 
+/* the ACK a data packet from side carries, see struct sr_conn.  The ACK
+   that was being held back rides on the packet, so it is no longer pending. */
+static int ack_to_carry(struct sr_conn *c, int side)
+{
+  struct sr_receiver *r = &c->receiver[side];
+
+  if (!r->anydelivered)
+    return NOTINUSE;
+  if (r->ackpending > 0)
+    EVENT(c, SR_EV_ACKSENT, side, r->lastseq, r->ackpending);
+  r->ackpending = 0;
+  return (int)seq_add(c, r->expectedseqnum, c->config.seqspace - 1);
+}
 
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+/* send the packet in slot again carrying acknum, the ACK current now from
+   ack_to_carry().  The one it was first sent with may have wrapped round the
+   sequence space since. */
+static void resend(struct sr_conn *c, int side, int slot, int acknum)
+{
+  struct pkt *packet = &c->sender[side].buffer[slot];
 
+  if (packet->acknum != acknum) {
+    packet->acknum = acknum;
+    packet->checksum = PacketChecksum(c->config.checksum, packet);
+  }
+  c->ops->tolayer3(c->user, side, packet);
+}
 
-/*VARIABLES FOR BIDIRECTIONAL TRAVEL*/
-static bool B_acked[SEQSPACE];
-static int B_windowfirst, B_windowlast, B_windowcount;
-static int B_nextseqnum = 0;
-static int B_window_full = 0;
+/* add a packet sent for the first time to the parity group, and send the
+   group's parity once it holds config.fec packets */
+static void add_parity(struct sr_conn *c, int side, const struct pkt *packet)
+{
+  struct sr_sender *s = &c->sender[side];
+  struct pkt parity;
+  int i;
+
+  if (s->feccount == 0)
+    s->fecfirst = (unsigned int)packet->seqnum;
+  for (i = 0; i < PAYLOADSIZE; i++)
+    s->fecparity[i] ^= packet->payload[i];
+  if (++s->feccount < c->config.fec)
+    return;
+
+  parity.seqnum = FECPARITY;
+  parity.acknum = (int)s->fecfirst;
+  for (i = 0; i < PAYLOADSIZE; i++) {
+    parity.payload[i] = s->fecparity[i];
+    s->fecparity[i] = 0;
+  }
+  parity.checksum = PacketChecksum(c->config.checksum, &parity);
+
+  if (TRACING(1))
+    printf("----%c: parity for %d packets from %u sent\n", side_name(side), s->feccount, s->fecfirst);
+  EVENT(c, SR_EV_PARITY, side, s->fecfirst, s->feccount);
+  c->ops->tolayer3(c->user, side, &parity);
+  c->stats.fec_sent++;
+  s->feccount = 0;
+}
+
+/* create packet nextseqnum in the slot after the last one in the window, where it
+   stays until ACKed, so its data is written once and sent and resent from there.
+   Everything but the checksum. */
+static struct pkt *new_packet(struct sr_conn *c, int side, const struct msg *message)
+{
+  struct sr_sender *s = &c->sender[side];
+  struct pkt *sendpkt;
+  int slot;
+
+  slot = (s->firstslot + s->windowcount) % c->config.windowsize;
+  sendpkt = &s->buffer[slot];
+  sendpkt->seqnum = (int)s->nextseqnum;
+  sendpkt->acknum = ack_to_carry(c, side);
+  memcpy(sendpkt->payload, message->data, PAYLOADSIZE);
+  s->acked[slot] = 0;
+  s->retries[slot] = 0;
+  s->sent_tick[slot] = s->current_tick;
+  s->due_tick[slot] = s->current_tick + s->timeout_ticks;
+  if (s->windowcount == 0 || s->due_tick[slot] < s->next_due_tick)
+    s->next_due_tick = s->due_tick[slot];
+
+  if (TRACING(1)) {
+    if (side == A)
+      printf("Sending packet %u to layer 3\n", s->nextseqnum);
+    else
+      printf("Sending packet %u from B to layer 3\n", s->nextseqnum);
+  }
+  EVENT(c, SR_EV_SEND, side, s->nextseqnum, 0);
+  return sendpkt;
+}
+
+/* send a message in the next slot of side's window, the caller checks there is room */
+static void send_msg(struct sr_conn *c, int side, const struct msg *message)
+{
+  struct sr_sender *s = &c->sender[side];
+  struct pkt *sendpkt;
+
+  /* create packet */
+  sendpkt = new_packet(c, side, message);
+  sendpkt->checksum = PacketChecksum(c->config.checksum, sendpkt);
+
+  /* send out packet */
+  c->ops->tolayer3(c->user, side, sendpkt);
+  if (c->config.fec > 0)
+    add_parity(c, side, sendpkt);
+
+  s->windowcount++;
+  c->stats.packets_sent++;
+  hist_record(&c->hist.window, (unsigned long)s->windowcount);
+
+  /* Only one timer so store send times, and run it to the earliest deadline */
+  arm_timer(c, side);
+
+  /* get next sequence number, wrap back to 0 */
+  s->nextseqnum = seq_add(c, s->nextseqnum, 1);
+}
+
+/* a message from layer 5 at side, to be sent to the other side */
+static void output(struct sr_conn *c, int side, const struct msg *message)
+{
+  struct sr_sender *s = &c->sender[side];
+
+  read_clock(c, side);
+  /* if not blocked waiting on ACK, and no older message is waiting either */
+  if ( s->windowcount < c->config.windowsize && s->backlogcount == 0) {
+    if (TRACING(2))
+      printf("----%c: New message arrives, send window is not full, send new messge to layer3!\n",
+             side_name(side));
+    send_msg(c, side, message);
+  }
+  /* window is full, queue the message until an ACK slides the window */
+  else if (s->backlogcount < c->config.backlog) {
+    if (TRACING(1))
+      printf("----%c: New message arrives, send window is full, message queued\n", side_name(side));
+    EVENT(c, SR_EV_QUEUED, side, s->nextseqnum, s->backlogcount);
+    s->backlog[(s->backlogfirst + s->backlogcount) % c->config.backlog] = *message;
+    s->backlogcount++;
+    c->stats.backlogged++;
+  }
+  /* if blocked,  window and backlog are full */
+  else {
+    if (TRACING(1))
+      printf("----%c: New message arrives, send window is full\n", side_name(side));
+    EVENT(c, SR_EV_WINDOWFULL, side, s->nextseqnum, 0);
+    c->stats.window_full++;
+  }
+}
+
+/* n messages from layer 5 at side.  The free window is filled in one pass,
+   BATCH packets at a time: their checksums in one loop, then one call to
+   the lower layer for all of them.  Whatever does not fit goes through
+   output() to be queued or dropped. */
+static int output_batch(struct sr_conn *c, int side, const struct msg *messages, int n)
+{
+  struct sr_sender *s = &c->sender[side];
+  struct pkt *batch[BATCH];
+  int done = 0;
+  int accepted;
+  int count, i;
+
+  read_clock(c, side);
+  while (done < n && s->backlogcount == 0 && s->windowcount < c->config.windowsize) {
+    for (count = 0; count < BATCH && done + count < n && s->windowcount < c->config.windowsize; count++) {
+      batch[count] = new_packet(c, side, &messages[done + count]);
+      s->windowcount++;
+      c->stats.packets_sent++;
+      hist_record(&c->hist.window, (unsigned long)s->windowcount);
+      s->nextseqnum = seq_add(c, s->nextseqnum, 1);
+    }
+    for (i = 0; i < count; i++)
+      batch[i]->checksum = PacketChecksum(c->config.checksum, batch[i]);
+    if (c->ops->tolayer3_batch != NULL)
+      c->ops->tolayer3_batch(c->user, side, (const struct pkt *const *)batch, count);
+    else
+      for (i = 0; i < count; i++)
+        c->ops->tolayer3(c->user, side, batch[i]);
+    /* the parity follows the packets it covers, a bit later than one by one */
+    if (c->config.fec > 0)
+      for (i = 0; i < count; i++)
+        add_parity(c, side, batch[i]);
+    done += count;
+  }
+  if (done > 0)
+    arm_timer(c, side);
+
+  accepted = done;
+  for (; done < n; done++) {
+    if (s->backlogcount < c->config.backlog)
+      accepted++;
+    output(c, side, &messages[done]);
+  }
+  return accepted;
+}
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-  void A_output(struct msg message)
-  {
-    struct pkt sendpkt;
-    int i;
-
-    /* if not blocked waiting on ACK */
-    if ( windowcount < WINDOWSIZE) {
-      if (TRACE > 1)
-        printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-      /* create packet */
-      sendpkt.seqnum = A_nextseqnum;
-      sendpkt.acknum = NOTINUSE;
-      for ( i=0; i<20 ; i++ ) 
-        sendpkt.payload[i] = message.data[i];
-      sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-      /* put packet in window buffer */
-      /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-      /*windowlast = (windowlast + 1) % WINDOWSIZE; 
-      buffer[windowlast] = sendpkt;*/
-
-      /* store packet in buffer */
-      buffer[sendpkt.seqnum] = sendpkt;
-      acked[sendpkt.seqnum] = 0;
-
-      /* send out packet */
-      if (TRACE > 0)
-        printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-      tolayer3 (A, sendpkt);
-
-      windowcount++;
-
-      /* Only one timer so store send times, and then only start timer if not already running. */
-      /*if (windowcount==1) {
-        starttimer(A, timeout_ticks);
-      */ 
-      if (!timer_running) {
-        starttimer(A, timeout_ticks);  
-        timer_running = 1;
-      }
+void sr_A_output(struct sr_conn *c, struct msg message)
+{
+  output(c, A, &message);
+}
+
+int sr_A_output_batch(struct sr_conn *c, const struct msg *messages, int n)
+{
+  return output_batch(c, A, messages, n);
+}
+
+/* split a message into fragments, see SR_FRAGHEADER */
+int sr_send(struct sr_conn *c, int side, const void *data, size_t len)
+{
+  struct sr_sender *s = &c->sender[side];
+  const char *p = data;
+  struct msg message;
+  size_t fragments = len == 0 ? 1 : (len + SR_FRAGDATA - 1) / SR_FRAGDATA;
+  size_t n;
+
+  if (!c->config.fragment)
+    return -1;
+  /* all or nothing, half a message would leave the receiver waiting for the rest */
+  if (fragments > (size_t)(c->config.windowsize - s->windowcount)
+                  + (size_t)(c->config.backlog - s->backlogcount)) {
+    if (TRACING(1))
+      printf("----%c: %lu fragments do not fit the window and backlog\n",
+             side_name(side), (unsigned long)fragments);
+    EVENT(c, SR_EV_WINDOWFULL, side, s->nextseqnum, 0);
+    c->stats.window_full++;
+    return -1;
+  }
+
+  do {
+    n = len < SR_FRAGDATA ? len : SR_FRAGDATA;
+    message.data[0] = (char)(n == len ? FRAGLAST : 0);
+    message.data[1] = (char)(n & 0xff);
+    message.data[2] = (char)(n >> 8);
+    memcpy(message.data + SR_FRAGHEADER, p, n);
+    memset(message.data + SR_FRAGHEADER + n, 0, SR_FRAGDATA - n);
+    output(c, side, &message);
+    p += n;
+    len -= n;
+  } while (len > 0);
+  return 0;
+}
+
+
+/* feed one round trip sample (in ticks), of a packet sent at tick sent, into the
+   estimator and recompute the timeout as in RFC 6298: RTO = SRTT + max(G, 4 * RTTVAR),
+   G being one tick */
+static void update_timeout(struct sr_sender *s, int side, int sample, int sent)
+{
+  float delta;
+  float rto;
+  int ticks;
+
+  if (!s->have_rtt_sample) {
+    s->srtt = sample;
+    s->rttvar = sample / 2.0;
+    s->have_rtt_sample = true;
+  } else {
+    delta = s->srtt - sample;
+    if (delta < 0)
+      delta = -delta;
+    s->rttvar = 0.75 * s->rttvar + 0.25 * delta;
+    s->srtt = 0.875 * s->srtt + 0.125 * sample;
+  }
+
+  rto = s->srtt + ((4 * s->rttvar > 1.0) ? 4 * s->rttvar : 1.0);
+  if (rto < MINTIMEOUT)
+    rto = MINTIMEOUT;
+  if (rto > MAXTIMEOUT)
+    rto = MAXTIMEOUT;
+  /* round up so a timeout never fires before the estimate */
+  ticks = (int)rto;
+  if (ticks < rto)
+    ticks++;
+
+  /* Karn's algorithm: the backed off timeout stays until a packet sent under it
+     is ACKed.  Earlier packets queued behind the ones that timed out, so their
+     samples say little about the path now. */
+  if (s->backoff_start >= 0 && sent < s->backoff_start) {
+    if (ticks > s->timeout_ticks)
+      s->timeout_ticks = ticks;
+  } else {
+    s->timeout_ticks = ticks;
+    /* the backoff is over, the next timeout doubles the timeout again */
+    s->backoff_start = -1;
+    s->backoff_tick = 0;
+  }
 
-      /* get next sequence number, wrap back to 0 */
-      A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+  if (TRACING(2))
+    printf("----%c: RTT sample %d, srtt %.2f, rttvar %.2f, timeout %d\n",
+           side_name(side), sample, s->srtt, s->rttvar, s->timeout_ticks);
+}
+
+/* a packet timed out, double the timeout as in RFC 6298 (5.5) and keep it until
+   update_timeout() has a sample of a packet sent since.  Packets expiring within
+   one timeout of the last doubling were sent under the old timeout and do not
+   double it again.  The packets not due yet were armed with the old timeout
+   too, and the one timer of RFC 6298 would restart with the new one, so their
+   deadlines move out by the difference; otherwise every packet queued behind
+   the one that timed out would be resent in turn. */
+static void backoff_timeout(struct sr_conn *c, int side)
+{
+  struct sr_sender *s = &c->sender[side];
+  int old = s->timeout_ticks;
+  int i;
+  int slot;
+
+  if (s->current_tick < s->backoff_tick)
+    return;
+  s->timeout_ticks = s->timeout_ticks > MAXTIMEOUT / 2 ? MAXTIMEOUT : 2 * s->timeout_ticks;
+  s->backoff_tick = s->current_tick + s->timeout_ticks;
+  s->backoff_start = s->current_tick;
+  for (i = 0; i < s->windowcount; i++) {
+    slot = (s->firstslot + i) % c->config.windowsize;
+    if (!s->acked[slot] && s->due_tick[slot] > s->current_tick)
+      s->due_tick[slot] += s->timeout_ticks - old;
+  }
+
+  if (TRACING(2))
+    printf("----%c: timeout backed off to %d\n", side_name(side), s->timeout_ticks);
+}
+
+/* mark every outstanding packet before cum, unless the ACK is older than the window,
+   returns how many were new */
+static int cumulative_ack(struct sr_conn *c, int side, unsigned int cum)
+{
+  struct sr_sender *s = &c->sender[side];
+  unsigned int n = seq_diff(c, s->windowfirst, cum);
+  int i;
+  int slot;
+  int newacks = 0;
+
+  if (n > (unsigned int)s->windowcount)
+    return 0;
+  for (i = 0; i < (int)n; i++) {
+    slot = (s->firstslot + i) % c->config.windowsize;
+    if (!s->acked[slot]) {
+      ack_slot(c, side, slot);
+      newacks++;
     }
-    /* if blocked,  window is full */
+  }
+  return newacks;
+}
+
+/* mark every outstanding packet a selective ACK covers, returns how many were new */
+static int selective_ack(struct sr_conn *c, int side, const struct pkt *packet)
+{
+  struct sr_sender *s = &c->sender[side];
+  const unsigned char *p = (const unsigned char *)packet->payload;
+  unsigned int cum, seq;
+  int i;
+  int slot;
+  int newacks;
+
+  if (packet->payload[0] != SACKMARK)
+    return 0;
+  cum = (unsigned int)p[SACKCUM] | (unsigned int)p[SACKCUM + 1] << 8
+        | (unsigned int)p[SACKCUM + 2] << 16 | (unsigned int)p[SACKCUM + 3] << 24;
+
+  /* everything before the cumulative ACK has arrived */
+  newacks = cumulative_ack(c, side, cum);
+
+  for (i = 0; i < SACKBITS && i < c->config.windowsize - 1; i++) {
+    if (!(p[SACKMAP + i / 8] & (1 << (i % 8))))
+      continue;
+    seq = seq_add(c, cum, (unsigned int)i + 1);
+    if (!outstanding(c, s, seq))
+      continue;
+    slot = send_slot(c, s, seq);
+    if (!s->acked[slot]) {
+      ack_slot(c, side, slot);
+      newacks++;
+    }
+  }
+  return newacks;
+}
+
+/* when the earliest unACK'ed packets have been acked, slide the window */
+static void slide(struct sr_conn *c, int side)
+{
+  struct sr_sender *s = &c->sender[side];
+
+  while (s->windowcount > 0 && s->acked[s->firstslot]) {
+    s->acked[s->firstslot] = 0;
+    s->due_tick[s->firstslot] = 0;
+    s->buffer[s->firstslot].seqnum = -1;
+    s->windowfirst = seq_add(c, s->windowfirst, 1);
+    s->firstslot = (s->firstslot + 1) % c->config.windowsize;
+    s->windowcount--;
+  }
+}
+
+/* the ACK part of an uncorrupted packet arriving at side, a bare ACK or the
+   cumulative ACK riding on a data packet */
+static void handle_ack(struct sr_conn *c, int side, const struct pkt *packet)
+{
+  struct sr_sender *s = &c->sender[side];
+  unsigned int acknum = (unsigned int)packet->acknum;
+  int slot;
+  int newacks = 0;
+  int rtt = -1;
+  int sent = 0;
+
+  if (TRACING(1))
+    printf("----%c: uncorrupted ACK %d is received\n", side_name(side), packet->acknum);
+  c->stats.total_ACKs_received++;
+
+  /* Karn's rule: only a packet sent once gives an unambiguous round trip sample,
+     and only the one the ACK names.  Others it covers may have been ACKed late,
+     after a lost packet in front of them or their own lost ACK. */
+  if (outstanding(c, s, acknum)) {
+    slot = send_slot(c, s, acknum);
+    if (!s->acked[slot] && s->retries[slot] == 0) {
+      sent = s->sent_tick[slot];
+      rtt = s->current_tick - sent;
+    }
+  }
+
+  if (packet->seqnum != NOTINUSE)
+    newacks = cumulative_ack(c, side, seq_add(c, acknum, 1));
+  /* check if new ACK or duplicate, ACKs for packets no longer outstanding count as duplicates */
+  else {
+    if (outstanding(c, s, acknum) && !s->acked[send_slot(c, s, acknum)]) {
+      slot = send_slot(c, s, acknum);
+      ack_slot(c, side, slot);
+      newacks++;
+    }
+
+    /* the selective ACK also covers packets whose own ACK was lost */
+    newacks += selective_ack(c, side, packet);
+  }
+
+  if (newacks == 0) {
+    if (TRACING(1))
+      printf ("----%c: duplicate ACK received, do nothing!\n", side_name(side));
+    EVENT(c, SR_EV_DUPACK, side, acknum, 0);
+    c->stats.dup_ACKs++;
+    return;
+  }
+
+  if (rtt >= 0) {
+    update_timeout(s, side, rtt, sent);
+    EVENT(c, SR_EV_RTT, side, s->timeout_ticks, rtt);
+  }
+
+  /* packet is a new ACK */
+  if (TRACING(1))
+    printf("----%c: ACK %d is not a duplicate\n", side_name(side), packet->acknum);
+  EVENT(c, SR_EV_ACK, side, acknum, newacks);
+  c->stats.new_ACKs++;
+  slide(c, side);
+
+  /* refill the window from the backlog */
+  while (s->windowcount < c->config.windowsize && s->backlogcount > 0) {
+    send_msg(c, side, &s->backlog[s->backlogfirst]);
+    s->backlogfirst = (s->backlogfirst + 1) % c->config.backlog;
+    s->backlogcount--;
+  }
+
+  /* stop the timer once nothing is outstanding or held */
+  arm_timer(c, side);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at A:
+   an ACK, or in bidirectional mode data from B that may carry an ACK */
+static void receive(struct sr_conn *c, int side, const struct pkt *packet);
+static void rebuild(struct sr_conn *c, int side, const struct pkt *packet);
+
+void sr_A_input(struct sr_conn *c, struct pkt packet)
+{
+  read_clock(c, A);
+  /* if received packet is not corrupted */
+  if (!IsCorrupted(c->config.checksum, &packet)) {
+    if (packet.seqnum == FECPARITY || packet.seqnum <= RSREPAIR)
+      rebuild(c, A, &packet);
     else {
-      if (TRACE > 0)
-        printf("----A: New message arrives, send window is full\n");
-      window_full++;
+      if (packet.seqnum == NOTINUSE || packet.acknum != NOTINUSE)
+        handle_ack(c, A, &packet);
+      if (packet.seqnum != NOTINUSE)
+        receive(c, A, &packet);
     }
   }
+  else {
+    if (TRACING(1))
+      printf ("----A: corrupted ACK is received, do nothing!\n");
+    EVENT(c, SR_EV_CORRUPT, A, packet.seqnum, 0);
+    c->stats.corrupt_dropped++;
+  }
+}
 
+static void send_ack(struct sr_conn *c, int side, unsigned int acknum);
 
-/* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
+/* send count repair packets over every packet in side's window, acked ones
+   included as the receiver holds those.  Later timeouts in the same window
+   carry on with new indexes, so their repair packets add to the earlier ones. */
+static void rs_send(struct sr_conn *c, int side, int count)
 {
+  struct sr_sender *s = &c->sender[side];
+  const unsigned char *data[RS_MAXSYMBOLS];
+  struct pkt repair;
+  int i;
 
-  /* if received ACK is not corrupted */ 
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
-
-    /* check if new ACK or duplicate */
-    if (!acked[packet.acknum]) {
-      acked[packet.acknum] = 1;
-
-      /* No need for wrap around logic because seqnum is used and no cum acks. */
-      /* packet is a new ACK */
-      if (TRACE > 0)
-        printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-      new_ACKs++;
-
-      /*When earliest unACK'ed packets have been acked, slide the window*/
-      while (acked[windowfirst]) {
-        acked[windowfirst] = 0;  
-        due_tick[windowfirst] = 0;
-        buffer[windowfirst].seqnum = -1;  
-        windowfirst = (windowfirst + 1) % SEQSPACE;
-        windowcount--;
-      }
+  if (s->rsfirst != s->windowfirst || s->rsblock != s->windowcount) {
+    s->rsfirst = s->windowfirst;
+    s->rsblock = s->windowcount;
+    s->rsnext = 0;
+  }
+  if (count > RS_MAXREPAIR)
+    count = RS_MAXREPAIR;
+  for (i = 0; i < s->windowcount; i++)
+    data[i] = (const unsigned char *)s->buffer[(s->firstslot + i) % c->config.windowsize].payload;
+  if (TRACING(1))
+    printf("----%c: time out,send %d repair packets over %d packets from %u!\n", side_name(side),
+           count, s->windowcount, s->windowfirst);
+
+  for (i = 0; i < count; i++) {
+    /* index and window size together stay below RS_MAXSYMBOLS */
+    if (s->rsnext + s->windowcount >= RS_MAXSYMBOLS)
+      s->rsnext = 0;
+    rs_encode((unsigned char *)repair.payload, data, s->windowcount, s->rsnext, PAYLOADSIZE);
+    repair.seqnum = RSREPAIR - (s->rsnext << 8 | s->windowcount);
+    repair.acknum = (int)s->windowfirst;
+    repair.checksum = PacketChecksum(c->config.checksum, &repair);
+    EVENT(c, SR_EV_RSREPAIR, side, s->windowfirst, s->rsnext << 8 | s->windowcount);
+    c->ops->tolayer3(c->user, side, &repair);
+    c->stats.rs_sent++;
+    s->rsnext++;
+  }
+}
 
-	    /* start timer again if there are still more unacked packets in window */
-      if (windowcount > 0) {
-        stoptimer(A);
-        starttimer(A, timeout_ticks);  
-        timer_running = 1;
-      } else {
-        stoptimer(A);
-        timer_running = 0;
+/* side's timer went off at the deadline arm_timer() set, the earliest packet
+   due or the held ACK.  Only packets whose own deadline in due_tick[] has passed are resent. */
+static void tick(struct sr_conn *c, int side)
+{
+  struct sr_sender *s = &c->sender[side];
+  struct sr_receiver *r = &c->receiver[side];
+  int i;
+  int slot;
+  int acknum = NOTINUSE;
+  bool carrying = false;
+  bool later_acked = false;
+  int unexplained = 0;
+  int covered = 0;
+
+  /* the timer went off at its deadline, even if the time read rounds down below it */
+  s->timer_running = 0;
+  read_clock(c, side);
+  if (s->current_tick < s->timer_due)
+    s->current_tick = s->timer_due;
+
+  /* nothing can have expired before the earliest deadline, which keeps large windows cheap */
+  if (s->windowcount > 0 && s->next_due_tick <= s->current_tick) {
+    s->next_due_tick = s->current_tick + MAXTIMEOUT;
+
+    /* from the last packet back, so later_acked tells whether anything sent
+       after a packet has arrived */
+    for (i = s->windowcount - 1; i >= 0; i--) {
+      slot = (s->firstslot + i) % c->config.windowsize;
+      if (s->acked[slot]) {
+        later_acked = true;
+        continue;
+      }
+      if (s->due_tick[slot] > s->current_tick)
+        continue;
+      /* the timeout has grown since the packet was sent, as the queue in front
+         of it did, so it is not late by the timeout now */
+      if (s->retries[slot] == 0 && s->sent_tick[slot] + s->timeout_ticks > s->current_tick)
+        s->due_tick[slot] = s->sent_tick[slot] + s->timeout_ticks;
+      /* backed off and nothing sent after it has arrived either, so it is as
+         likely queued behind the first packet as lost.  As RFC 6298 (5.4)
+         resends only the earliest, the others wait another timeout.  Repair
+         packets would cover the whole window, so they wait the same way. */
+      else if (i > 0 && !later_acked && (s->backoff_start >= 0 || c->config.rsrepair > 0))
+        s->due_tick[slot] = s->current_tick + s->timeout_ticks;
+      else {
+        /* a later packet arrived, so this one was lost and the timeout was not
+           too short.  Only a timeout with no such sign backs it off. */
+        if (!later_acked)
+          unexplained++;
+        /* packets timing out for the first time are covered by repair packets once
+           a later packet shows a loss or the timeout has been backed off, later
+           timeouts resend so a window the receiver cannot decode still moves */
+        if (c->config.rsrepair > 0 && s->retries[slot] == 0 && (later_acked || s->backoff_start >= 0))
+          covered++;
       }
-    } else
-      if (TRACE > 0)
-      printf ("----A: duplicate ACK received, do nothing!\n");
+    }
+    if (unexplained > 0)
+      backoff_timeout(c, side);
+
+    for (i = 0; i < s->windowcount; i++) {
+      slot = (s->firstslot + i) % c->config.windowsize;
+      if (s->acked[slot])
+        continue;
+
+      if (s->due_tick[slot] <= s->current_tick) {
+        if (covered == 0 || s->retries[slot] > 0) {
+          if (TRACING(1))
+            printf("----%c: time out,resend packet %u!\n", side_name(side),
+                   (unsigned int)s->buffer[slot].seqnum);
+          EVENT(c, SR_EV_RESEND, side, s->buffer[slot].seqnum, s->retries[slot] + 1);
+
+          /* the held ACK rides on the first packet resent */
+          if (!carrying) {
+            acknum = ack_to_carry(c, side);
+            carrying = true;
+          }
+          resend(c, side, slot, acknum);
+          c->stats.packets_resent++;
+        }
+
+        /* the timeout is already backed off, so repeated timeouts of this packet wait longer */
+        s->retries[slot]++;
+        s->due_tick[slot] = s->current_tick + s->timeout_ticks;
+      }
+      if (s->due_tick[slot] < s->next_due_tick)
+        s->next_due_tick = s->due_tick[slot];
+    }
+    if (covered > 0)
+      rs_send(c, side, covered + c->config.rsrepair);
   }
-  else 
-    if (TRACE > 0)
-      printf ("----A: corrupted ACK is received, do nothing!\n");
+
+  /* no data left this end in time for the held ACK to ride on */
+  if (r->ackpending > 0 && r->ackdue <= s->current_tick) {
+    if (TRACING(1))
+      printf("----%c: delayed ACK timer expired, ACK %u\n", side_name(side), r->lastseq);
+    EVENT(c, SR_EV_TIMER, side, r->lastseq, r->ackpending);
+    send_ack(c, side, r->lastseq);
+  }
+
+  arm_timer(c, side);
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+void sr_A_timerinterrupt(struct sr_conn *c)
 {
+  tick(c, A);
+}
+
+
+/********* Receiver procedures, B's and in bidirectional mode A's ************/
+
+static bool receiver_init(struct sr_conn *c, int side)
+{
+  struct sr_receiver *r = &c->receiver[side];
+
+  r->expectedseqnum = 0;
+  r->firstslot = 0;
+  r->anydelivered = false;
+  r->ackpending = 0;
+  r->buffer = alloc_window(c, r->buffer, sizeof(struct pkt));
+  r->received = alloc_window(c, r->received, sizeof(int));
+  r->rscount = 0;
+  r->messagelen = 0;
+  r->messagelost = false;
+  free(r->rsbuffer);
+  r->rsbuffer = NULL;
+  if (c->config.rsrepair > 0)
+    r->rsbuffer = calloc(RS_MAXREPAIR, sizeof(struct pkt));
+  return r->buffer && r->received && (c->config.rsrepair == 0 || r->rsbuffer);
+}
+
+/* slot of an in window sequence number in a receiver's arrays */
+static int recv_slot(const struct sr_conn *c, const struct sr_receiver *r, unsigned int seqnum)
+{
+  return (int)((r->firstslot + seq_diff(c, r->expectedseqnum, seqnum)) % c->config.windowsize);
+}
+
+/* the sequence number just before expectedseqnum, for cumulative ACKs */
+static unsigned int recv_lastack(const struct sr_conn *c, const struct sr_receiver *r)
+{
+  return seq_add(c, r->expectedseqnum, c->config.seqspace - 1);
+}
+
+/* send a bare ACK for acknum, carrying the cumulative ACK and the selective ACK bitmap */
+static void send_ack(struct sr_conn *c, int side, unsigned int acknum)
+{
+  struct sr_receiver *r = &c->receiver[side];
+  struct pkt sendpkt;
   int i;
-  int seqnum;
-  int has_unacked = 0;
-  current_tick++;
 
-  if (TRACE > 0)
-    printf("----A: time out,resend packets!\n");
+  sendpkt.seqnum = NOTINUSE;
+  sendpkt.acknum = (int)acknum;
+  memset(sendpkt.payload, 0, PAYLOADSIZE);
+  sendpkt.payload[0] = SACKMARK;
+  for (i = 0; i < 4; i++)
+    sendpkt.payload[SACKCUM + i] = (char)(unsigned char)(r->expectedseqnum >> (8 * i));
+  /* expectedseqnum itself is never held, the map starts at the packet after it */
+  for (i = 0; i < SACKBITS && i < c->config.windowsize - 1; i++)
+    if (r->received[(r->firstslot + 1 + i) % c->config.windowsize])
+      sendpkt.payload[SACKMAP + i / 8] = (char)(unsigned char)(sendpkt.payload[SACKMAP + i / 8] | (1 << (i % 8)));
+  sendpkt.checksum = PacketChecksum(c->config.checksum, &sendpkt);
+  EVENT(c, SR_EV_ACKSENT, side, acknum, r->ackpending);
+  c->ops->tolayer3(c->user, side, &sendpkt);
+
+  /* this ACK covers everything a delayed one would have, the ticking timer stops by itself */
+  r->ackpending = 0;
+}
+
+/* hold the ACK for an in order arrival until config.ackevery of them are
+   waiting or config.ackdelay ticks have passed, whichever is first.  Data
+   sent from this end meanwhile carries the ACK instead, see ack_to_carry(). */
+static void delay_ack(struct sr_conn *c, int side, unsigned int acknum)
+{
+  struct sr_receiver *r = &c->receiver[side];
+  struct sr_sender *s = &c->sender[side];
+
+  r->lastseq = acknum;
+  r->ackpending++;
+  if (r->ackpending >= (c->config.ackevery > 0 ? c->config.ackevery : 2)) {
+    send_ack(c, side, acknum);
+    return;
+  }
 
-  for (i = 0; i < windowcount; i++) {
-    seqnum = (windowfirst + i) % SEQSPACE;
+  /* the held ACK goes when this end's timer reaches the tick it is due */
+  if (r->ackpending == 1) {
+    r->ackdue = s->current_tick + c->config.ackdelay;
+    arm_timer(c, side);
+  }
+}
 
-    if (!acked[seqnum]) {
-      if (TRACE > 0)
-        printf("---A: resending packet %d\n", buffer[seqnum].seqnum);
+/* hand an in order payload to the application, in fragment mode
+   once the last fragment of its message is here */
+static void deliver(struct sr_conn *c, int side, char *payload)
+{
+  struct sr_receiver *r = &c->receiver[side];
+  const unsigned char *header = (const unsigned char *)payload;
+  size_t n = (size_t)header[1] | (size_t)header[2] << 8;
+  size_t cap;
+  char *grown;
+
+  if (!c->config.fragment) {
+    c->ops->tolayer5(c->user, side, payload);
+    return;
+  }
+  if (n > SR_FRAGDATA)
+    n = SR_FRAGDATA;
+
+  /* a message in one fragment needs no copy */
+  if ((header[0] & FRAGLAST) && r->messagelen == 0 && !r->messagelost) {
+    c->ops->deliver(c->user, side, payload + SR_FRAGHEADER, n);
+    c->stats.reassembled++;
+    return;
+  }
 
-      tolayer3(A, buffer[seqnum]);
-      has_unacked = 1;
+  if (!r->messagelost && r->messagelen + n > r->messagecap) {
+    cap = r->messagecap > 0 ? 2 * r->messagecap : 4 * SR_FRAGDATA;
+    while (cap < r->messagelen + n)
+      cap *= 2;
+    grown = realloc(r->message, cap);
+    if (grown == NULL) {
+      fprintf(stderr, "sr: cannot allocate %lu bytes to reassemble a message, dropped\n", (unsigned long)cap);
+      r->messagelost = true;
+    } else {
+      r->message = grown;
+      r->messagecap = cap;
+    }
+  }
+  if (!r->messagelost) {
+    memcpy(r->message + r->messagelen, payload + SR_FRAGHEADER, n);
+    r->messagelen += n;
+  }
+  if (header[0] & FRAGLAST) {
+    if (!r->messagelost) {
+      c->ops->deliver(c->user, side, r->message, r->messagelen);
+      c->stats.reassembled++;
     }
+    r->messagelen = 0;
+    r->messagelost = false;
   }
+}
 
-  if (has_unacked) {
-    stoptimer(A);  
-    starttimer(A, timeout_ticks);
-    timer_running = 1;
+/* take a data packet into side's receive window, in the slot of its sequence
+   number, without delivering or ACKing it.  *inorder is set when it is new
+   and the packet expected next.  Returns false when it is outside the window. */
+static bool buffer_packet(struct sr_conn *c, int side, const struct pkt *packet, bool *inorder)
+{
+  struct sr_receiver *r = &c->receiver[side];
+  int slot;
+  unsigned int seq = (unsigned int)packet->seqnum;
+
+  if (TRACING(1))
+    printf("----%c: packet %u is correctly received, send ACK!\n", side_name(side), seq);
+  c->stats.packets_received++;
+
+  if (!isInWindow(c, r->expectedseqnum, seq)) {
+    EVENT(c, SR_EV_RECEIVE, side, seq, 0);
+    c->stats.out_of_window++;
+    return false;
+  }
+
+  slot = recv_slot(c, r, seq);
+  *inorder = (seq == r->expectedseqnum);
+  if (!r->received[slot]) {
+    r->received[slot] = 1;
+    /* repaired packets are rebuilt in their slot already */
+    if (packet != &r->buffer[slot])
+      r->buffer[slot] = *packet;
+
+    if (TRACING(1))
+      printf("----%c: packet %u received and buffered\n", side_name(side), seq);
+    EVENT(c, SR_EV_BUFFER, side, seq, 0);
   } else {
-    stoptimer(A);
-    timer_running = 0;
+    if (TRACING(1))
+      printf("----%c: duplicate packet %u received, already buffered\n", side_name(side), seq);
+    EVENT(c, SR_EV_DUP, side, seq, 0);
+    *inorder = false;
   }
+  return true;
 }
 
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+/* pass the packets now in order at side to layer 5 and slide the window past
+   them.  With an ops->tolayer5_batch the run goes in one call, BATCH at a
+   time.  Returns the number delivered. */
+static int deliver_inorder(struct sr_conn *c, int side)
 {
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
-		     new packets are placed in winlast + 1 
-		     so initially this is set to -1
-		   */
-  windowcount = 0;
+  struct sr_receiver *r = &c->receiver[side];
+  char *run[BATCH];
+  bool vector = c->ops->tolayer5_batch != NULL && !c->config.fragment;
+  int count = 0;
+  int delivered = 0;
+
+  while (r->received[r->firstslot]) {
+    /* the slot keeps its payload until a packet a window later arrives */
+    if (vector)
+      run[count++] = r->buffer[r->firstslot].payload;
+    else
+      deliver(c, side, r->buffer[r->firstslot].payload);
+    EVENT(c, SR_EV_DELIVER, side, r->expectedseqnum, 0);
+    c->stats.delivered++;
+
+    /* the repair packets held for a block are no use once all of it is here,
+       and would be taken for those of the same numbers a sequence space later */
+    if (r->rscount > 0 && r->expectedseqnum == seq_add(c, r->rsfirst, (unsigned int)r->rsblock - 1))
+      r->rscount = 0;
+    r->received[r->firstslot] = 0;
+    r->expectedseqnum = seq_add(c, r->expectedseqnum, 1);
+    r->firstslot = (r->firstslot + 1) % c->config.windowsize;
+    r->anydelivered = true;
+    delivered++;
+
+    if (count == BATCH) {
+      c->ops->tolayer5_batch(c->user, side, run, count);
+      count = 0;
+    }
+  }
+  if (count > 0)
+    c->ops->tolayer5_batch(c->user, side, run, count);
+  return delivered;
 }
 
+/* the ACK for a data packet outside side's window */
+static unsigned int stale_ack(const struct sr_conn *c, const struct sr_receiver *r, unsigned int seq)
+{
+  /* a packet from the previous window was already delivered but its ACK was lost,
+     so ACK it again or the sender will keep resending it */
+  if (seq_diff(c, seq, r->expectedseqnum) - 1 < (unsigned int)c->config.windowsize)
+    return seq;
+  return recv_lastack(c, r);
+}
 
+/* the data part of an uncorrupted packet arriving at side */
+static void receive(struct sr_conn *c, int side, const struct pkt *packet)
+{
+  unsigned int seq = (unsigned int)packet->seqnum;
+  bool inorder;
+  int delivered;
 
-/********* Receiver (B)  variables and procedures ************/
+  if (!buffer_packet(c, side, packet, &inorder)) {
+    send_ack(c, side, stale_ack(c, &c->receiver[side], seq));
+    return;
+  }
+  delivered = deliver_inorder(c, side);
 
-/* These variables are for B section*/
-             
+  /* ACK after delivering so the cumulative ACK covers this packet too.
+     Only plain in order arrivals are delayed, a gap, a filled gap or a
+     duplicate means the sender is missing something and is ACKed at once. */
+  if (c->config.ackdelay > 0 && inorder && delivered == 1)
+    delay_ack(c, side, seq);
+  else
+    send_ack(c, side, seq);
+}
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+/* the packet seqnum if the receiver still holds it: buffered in the window, or
+   delivered lately and its slot not reused yet */
+static const struct pkt *held_packet(const struct sr_conn *c, const struct sr_receiver *r,
+                                     unsigned int seqnum)
+{
+  unsigned int back;
+  int slot;
 
+  if (isInWindow(c, r->expectedseqnum, seqnum)) {
+    slot = recv_slot(c, r, seqnum);
+    return r->received[slot] ? &r->buffer[slot] : NULL;
+  }
+  back = seq_diff(c, seqnum, r->expectedseqnum);
+  if (back > (unsigned int)c->config.windowsize)
+    return NULL;
+  slot = (r->firstslot + c->config.windowsize - (int)back) % c->config.windowsize;
+  if (r->received[slot] || r->buffer[slot].seqnum != (int)seqnum)
+    return NULL;
+  return &r->buffer[slot];
+}
 
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+/* a parity packet arrived at side.  If exactly one packet of its group is
+   missing and still expected, rebuild it from the parity and the others
+   and buffer it as if it had arrived, saving the sender's timeout.  Returns
+   the number of packets buffered, with *acknum the sequence number to ACK;
+   the caller delivers and ACKs them, see rebuild(). */
+static int repair(struct sr_conn *c, int side, const struct pkt *parity, unsigned int *acknum)
 {
-  struct pkt sendpkt;
+  struct sr_receiver *r = &c->receiver[side];
+  const struct pkt *held;
+  struct pkt *rebuilt;
+  unsigned int seq;
+  unsigned int lost = 0;
+  bool inorder;
+  int i, j;
+  int missing = 0;
+
+  for (i = 0; i < c->config.fec; i++) {
+    seq = seq_add(c, (unsigned int)parity->acknum, (unsigned int)i);
+    if (held_packet(c, r, seq) == NULL) {
+      if (++missing > 1)
+        return 0;
+      lost = seq;
+    }
+  }
+  /* nothing lost, or only a packet delivered long ago */
+  if (missing == 0 || !isInWindow(c, r->expectedseqnum, lost))
+    return 0;
+
+  /* rebuild it in the slot it would have arrived in, the group's other
+     packets are all in other slots */
+  rebuilt = &r->buffer[recv_slot(c, r, lost)];
+  rebuilt->seqnum = (int)lost;
+  rebuilt->acknum = NOTINUSE;
+  rebuilt->checksum = 0;
+  memcpy(rebuilt->payload, parity->payload, PAYLOADSIZE);
+  for (i = 0; i < c->config.fec; i++) {
+    held = held_packet(c, r, seq_add(c, (unsigned int)parity->acknum, (unsigned int)i));
+    if (held == NULL)
+      continue;
+    for (j = 0; j < PAYLOADSIZE; j++)
+      rebuilt->payload[j] ^= held->payload[j];
+  }
+
+  if (TRACING(1))
+    printf("----%c: packet %u rebuilt from parity\n", side_name(side), lost);
+  EVENT(c, SR_EV_REPAIR, side, lost, 0);
+  c->stats.fec_recovered++;
+  buffer_packet(c, side, rebuilt, &inorder);
+  *acknum = lost;
+  return 1;
+}
+
+/* a Reed-Solomon repair packet arrived at side.  Once as many repair packets
+   of its block are held as packets of the block are missing, decode those
+   and buffer them as if they had arrived.  Returns the number buffered, as
+   repair() does. */
+static int rs_receive(struct sr_conn *c, int side, const struct pkt *packet, unsigned int *acknum)
+{
+  struct sr_receiver *r = &c->receiver[side];
+  unsigned char *data[RS_MAXSYMBOLS];
+  char present[RS_MAXSYMBOLS];
+  const unsigned char *repair[RS_MAXREPAIR];
+  int index[RS_MAXREPAIR];
+  unsigned int lost[RS_MAXREPAIR];
+  int erased[RS_MAXREPAIR];
+  struct pkt *rebuilt;
+  const struct pkt *held;
+  unsigned int first = (unsigned int)packet->acknum;
+  unsigned int seq;
+  int code = RSREPAIR - packet->seqnum;
+  int n = code & 0xff;
+  bool inorder;
   int i;
-  int seq = packet.seqnum;
-
-  /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))) {
-    int upper;
-    int in_window;
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
-
-    upper = (expectedseqnum + WINDOWSIZE) % SEQSPACE;
-    in_window = (expectedseqnum <= upper)
-                    ? (seq >= expectedseqnum && seq < upper)
-                    : (seq >= expectedseqnum || seq < upper);
-
-    
-    if (in_window) {
-      if (!B_received[seq]) {
-        B_received[seq] = 1;
-        B_buffer[seq] = packet;
-
-        if (TRACE > 0)
-          printf("----B: packet %d received and buffered\n", seq);
-      } else {
-        if (TRACE > 0)
-          printf("----B: duplicate packet %d received, already buffered\n", seq);
-      }
+  int missing = 0;
+
+  if (n == 0 || n > c->config.windowsize || (code >> 8) + n >= RS_MAXSYMBOLS)
+    return 0;
+  /* the sender's window has moved on, the repair packets held are of no more use */
+  if (r->rscount > 0 && (r->rsfirst != first || r->rsblock != n))
+    r->rscount = 0;
+  for (i = 0; i < r->rscount; i++)
+    if (r->rsbuffer[i].seqnum == packet->seqnum)
+      return 0;
+  if (r->rscount == RS_MAXREPAIR)
+    return 0;
+  r->rsfirst = first;
+  r->rsblock = n;
+  r->rsbuffer[r->rscount++] = *packet;
+
+  /* the block is the sender's window, so every packet of it that arrived is
+     still buffered or in the slot it was delivered from, see held_packet() */
+  for (i = 0; i < n; i++) {
+    seq = seq_add(c, first, (unsigned int)i);
+    held = held_packet(c, r, seq);
+    present[i] = held != NULL;
+    if (held != NULL) {
+      data[i] = (unsigned char *)held->payload;
+      continue;
+    }
+    if (!isInWindow(c, r->expectedseqnum, seq)) {
+      r->rscount = 0;
+      return 0;
+    }
+    /* more missing than repair packets so far, wait for the others */
+    if (missing == r->rscount)
+      return 0;
+    lost[missing] = seq;
+    erased[missing] = i;
+    missing++;
+  }
+  if (missing == 0) {
+    r->rscount = 0;
+    return 0;
+  }
 
-      sendpkt.seqnum = 0;
-      sendpkt.acknum = seq;
-      for (i = 0; i < 20; i++)
-        sendpkt.payload[i] = '0';
-      sendpkt.checksum = ComputeChecksum(sendpkt);
-      tolayer3(B, sendpkt);
+  /* decode the missing packets in the slots they would have arrived in,
+     no packet of the block is in one of those */
+  for (i = 0; i < missing; i++) {
+    rebuilt = &r->buffer[recv_slot(c, r, lost[i])];
+    rebuilt->seqnum = (int)lost[i];
+    rebuilt->acknum = NOTINUSE;
+    rebuilt->checksum = 0;
+    data[erased[i]] = (unsigned char *)rebuilt->payload;
+  }
 
+  for (i = 0; i < r->rscount; i++) {
+    repair[i] = (const unsigned char *)r->rsbuffer[i].payload;
+    index[i] = (RSREPAIR - r->rsbuffer[i].seqnum) >> 8;
+  }
+  if (rs_decode(data, present, n, repair, index, r->rscount, PAYLOADSIZE) != 0)
+    return 0;
+  r->rscount = 0;
+
+  for (i = 0; i < missing; i++) {
+    if (TRACING(1))
+      printf("----%c: packet %u decoded from repair packets\n", side_name(side), lost[i]);
+    EVENT(c, SR_EV_RSDECODE, side, lost[i], 0);
+    c->stats.rs_recovered++;
+    buffer_packet(c, side, &r->buffer[recv_slot(c, r, lost[i])], &inorder);
+  }
+  *acknum = lost[missing - 1];
+  return missing;
+}
 
-      while (B_received[expectedseqnum]) {
-        tolayer5(B, B_buffer[expectedseqnum].payload);
-        packets_received++;
+/* a parity or repair packet arrived at side on its own.  Deliver what it
+   rebuilt and ACK that at once, a rebuilt packet means the sender lost one */
+static void rebuild(struct sr_conn *c, int side, const struct pkt *packet)
+{
+  unsigned int acknum = 0;
+  int count;
 
-        B_received[expectedseqnum] = 0;   
-        expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-      }
-    } else {
+  if (packet->seqnum == FECPARITY)
+    count = repair(c, side, packet, &acknum);
+  else
+    count = rs_receive(c, side, packet, &acknum);
+  if (count == 0)
+    return;
+  deliver_inorder(c, side);
+  send_ack(c, side, acknum);
+}
 
-      sendpkt.seqnum = 0;
-      sendpkt.acknum = (expectedseqnum == 0) ? SEQSPACE - 1 : expectedseqnum - 1;
-      for (i = 0; i < 20; i++)
-        sendpkt.payload[i] = '0';
-      sendpkt.checksum = ComputeChecksum(sendpkt);
-      tolayer3(B, sendpkt);
+/* called from layer 3, when a packet arrives for layer 4 at B */
+void sr_B_input(struct sr_conn *c, struct pkt packet)
+{
+  read_clock(c, B);
+  /* if not corrupted, data from A or in bidirectional mode an ACK for B's data */
+  if  ( (!IsCorrupted(c->config.checksum, &packet))) {
+    if (packet.seqnum == FECPARITY || packet.seqnum <= RSREPAIR)
+      rebuild(c, B, &packet);
+    else {
+      if (packet.seqnum == NOTINUSE || packet.acknum != NOTINUSE)
+        handle_ack(c, B, &packet);
+      if (packet.seqnum != NOTINUSE)
+        receive(c, B, &packet);
     }
   }
   else {
     /* packet is corrupted or out of order, resend last ACK */
-    int last_ack;
-    if (TRACE > 0) 
+    if (TRACING(1))
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
+    EVENT(c, SR_EV_CORRUPT, B, packet.seqnum, 0);
+    c->stats.corrupt_dropped++;
 
-    last_ack = (expectedseqnum == 0) ? SEQSPACE - 1 : expectedseqnum - 1;
-
-    sendpkt.seqnum = 0;
-    sendpkt.acknum = last_ack;
-    for (i = 0; i < 20; i++)
-        sendpkt.payload[i] = '0';
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-    tolayer3(B, sendpkt);
+    send_ack(c, B, recv_lastack(c, &c->receiver[B]));
   }
 }
 
-/* the following routine will be called once (only) before any other */
-/* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+/******************************************************************************
+ * The following functions need be completed only for bi-directional messages *
+ *****************************************************************************/
+
+/* n packets arriving at side together.  The checksums are checked in one
+   loop, BATCH at a time, and the data packets buffered.  Then the run they
+   complete is delivered once and one ACK goes back, whose cumulative and
+   selective ACK cover them all.  Packets rebuilt from parity and repair
+   packets are buffered the same way, ACK packets take their usual path. */
+static void input_batch(struct sr_conn *c, int side, const struct pkt *packets, int n)
 {
-  int i;
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
-  for (i = 0; i < SEQSPACE; i++) {
-    B_received[i] = 0;
+  struct sr_receiver *r = &c->receiver[side];
+  const struct pkt *packet;
+  bool corrupt[BATCH];
+  bool inorder;
+  bool ack = false;
+  bool inwindow = false;
+  unsigned int acknum = 0;
+  unsigned int seq = 0;
+  int done, count, rebuilt, i;
+
+  read_clock(c, side);
+  for (done = 0; done < n; done += count) {
+    count = n - done < BATCH ? n - done : BATCH;
+    for (i = 0; i < count; i++)
+      corrupt[i] = IsCorrupted(c->config.checksum, &packets[done + i]);
+
+    for (i = 0; i < count; i++) {
+      packet = &packets[done + i];
+      if (corrupt[i]) {
+        if (TRACING(1))
+          printf("----%c: corrupted packet is received, do nothing!\n", side_name(side));
+        EVENT(c, SR_EV_CORRUPT, side, packet->seqnum, 0);
+        c->stats.corrupt_dropped++;
+        /* B answers corruption with its last ACK, as in sr_B_input() */
+        if (side == B)
+          ack = true;
+      }
+      else if (packet->seqnum == FECPARITY || packet->seqnum <= RSREPAIR) {
+        if (packet->seqnum == FECPARITY)
+          rebuilt = repair(c, side, packet, &seq);
+        else
+          rebuilt = rs_receive(c, side, packet, &seq);
+        if (rebuilt > 0) {
+          ack = true;
+          acknum = seq;
+          inwindow = true;
+        }
+      }
+      else {
+        if (packet->seqnum == NOTINUSE || packet->acknum != NOTINUSE)
+          handle_ack(c, side, packet);
+        if (packet->seqnum != NOTINUSE) {
+          ack = true;
+          if (buffer_packet(c, side, packet, &inorder)) {
+            acknum = (unsigned int)packet->seqnum;
+            inwindow = true;
+          }
+        }
+      }
+    }
   }
+
+  deliver_inorder(c, side);
+  /* packets from before the window are covered by the cumulative ACK */
+  if (ack)
+    send_ack(c, side, inwindow ? acknum : recv_lastack(c, r));
 }
 
-/******************************************************************************
- * The following functions need be completed only for bi-directional messages *
- *****************************************************************************/
+void sr_A_input_batch(struct sr_conn *c, const struct pkt *packets, int n)
+{
+  input_batch(c, A, packets, n);
+}
+
+void sr_B_input_batch(struct sr_conn *c, const struct pkt *packets, int n)
+{
+  input_batch(c, B, packets, n);
+}
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)  
+void sr_B_output(struct sr_conn *c, struct msg message)
 {
-  struct pkt sendpkt;
-  int i;
+  output(c, B, &message);
+}
+
+int sr_B_output_batch(struct sr_conn *c, const struct msg *messages, int n)
+{
+  return output_batch(c, B, messages, n);
+}
 
-  /* if window is not full */
-  if (B_windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
-      printf("----B: New message arrives, send window is not full, send new message to layer3!\n");
+/* called when B's timer goes off */
+void sr_B_timerinterrupt(struct sr_conn *c)
+{
+  tick(c, B);
+}
 
-    sendpkt.seqnum = B_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i = 0; i < 20; i++)
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
 
-    B_windowlast = (B_windowlast + 1) % WINDOWSIZE;
-    B_buffer[B_windowlast] = sendpkt;
-    B_windowcount++;
+/********* Connection lifetime ************/
 
-    if (TRACE > 0)
-      printf("Sending packet %d from B to layer 3\n", sendpkt.seqnum);
-    tolayer3(B, sendpkt);
+static void free_buffers(struct sr_conn *c)
+{
+  int side;
+
+  for (side = A; side <= B; side++) {
+    free(c->sender[side].buffer);
+    free(c->sender[side].acked);
+    free(c->sender[side].due_tick);
+    free(c->sender[side].sent_tick);
+    free(c->sender[side].retries);
+    free(c->sender[side].backlog);
+    free(c->receiver[side].buffer);
+    free(c->receiver[side].received);
+    free(c->receiver[side].rsbuffer);
+    free(c->receiver[side].message);
+  }
+}
 
-    B_acked[B_windowlast] = 0;
+struct sr_conn *sr_conn_create(const struct sr_config *config, const struct sr_ops *ops, void *user)
+{
+  struct sr_conn *c;
 
-    if (B_windowcount == 1) {
-      starttimer(B, timeout_ticks);
-    }
+  if (!valid_config(config))
+    return NULL;
+  if (ops->now == NULL) {
+    fprintf(stderr, "sr: the timers need an ops->now\n");
+    return NULL;
+  }
+  if (config->fragment && ops->deliver == NULL) {
+    fprintf(stderr, "sr: fragment needs an ops->deliver for whole messages\n");
+    return NULL;
+  }
+  c = calloc(1, sizeof(struct sr_conn));
+  if (c == NULL)
+    return NULL;
+  c->config = *config;
+  if (c->config.seqspace == 0)
+    c->config.seqspace = MAXSEQSPACE;
+  c->ops = ops;
+  c->user = user;
+  c->traceid = sr_trace_conn_id();
+  if (!sender_init(c, A) || !receiver_init(c, A) || !sender_init(c, B) || !receiver_init(c, B)) {
+    sr_conn_destroy(c);
+    return NULL;
+  }
+  return c;
+}
 
-    B_nextseqnum = (B_nextseqnum + 1) % SEQSPACE;
-  } else {
-    if (TRACE > 0)
-      printf("----B: New message arrives, send window is full\n");
-    B_window_full++;
+void sr_conn_destroy(struct sr_conn *c)
+{
+  if (c == NULL)
+    return;
+  free_buffers(c);
+  free(c);
+}
+
+const struct sr_stats *sr_conn_stats(const struct sr_conn *c)
+{
+  return &c->stats;
+}
+
+const struct sr_histograms *sr_conn_histograms(const struct sr_conn *c)
+{
+  return &c->hist;
+}
+
+
+/********* Default connection driven by the emulator ************/
+
+static void emulator_tolayer3(void *user, int AorB, const struct pkt *packet)
+{
+  (void)user;
+  tolayer3(AorB, *packet);
+}
+
+static void emulator_tolayer5(void *user, int AorB, char *data)
+{
+  (void)user;
+  tolayer5(AorB, data);
+}
+
+static void emulator_starttimer(void *user, int AorB, float increment)
+{
+  (void)user;
+  starttimer(AorB, increment);
+}
+
+static void emulator_stoptimer(void *user, int AorB)
+{
+  (void)user;
+  stoptimer(AorB);
+}
+
+static double emulator_now(void *user)
+{
+  (void)user;
+  return currenttime();
+}
+
+static const struct sr_ops emulator_ops = {
+  emulator_tolayer3, emulator_tolayer5, emulator_starttimer, emulator_stoptimer, emulator_now,
+  NULL, NULL, NULL
+};
+
+/* window and sequence space in use, changed with sr_configure() before A_init()/B_init() */
+static struct sr_config config = { WINDOWSIZE, SEQSPACE, SR_CHECKSUM_SUM, 0, 0, 0, 0, 0, 0, 0 };
+static struct sr_conn default_conn;
+static struct sr_stats published;    /* default_conn stats already added to the emulator's */
+
+const struct sr_conn *sr_default_conn(void)
+{
+  return &default_conn;
+}
+
+int sr_configure(const struct sr_config *newconfig)
+{
+  if (!valid_config(newconfig))
+    return -1;
+  /* the emulator's tolayer5() takes one struct msg at a time */
+  if (newconfig->fragment) {
+    fprintf(stderr, "sr: the emulator connection has no fragment mode, use sr_conn_create()\n");
+    return -1;
   }
+  config = *newconfig;
+  if (config.seqspace == 0)
+    config.seqspace = MAXSEQSPACE;
+  return 0;
 }
 
-/* called when B's timer goes off */
-void B_timerinterrupt(void)
+/* the emulator keeps its own statistics, add whatever the default connection counted */
+static void publish_stats(void)
 {
-  int i;
+  window_full += default_conn.stats.window_full - published.window_full;
+  total_ACKs_received += default_conn.stats.total_ACKs_received - published.total_ACKs_received;
+  new_ACKs += default_conn.stats.new_ACKs - published.new_ACKs;
+  packets_resent += default_conn.stats.packets_resent - published.packets_resent;
+  packets_received += default_conn.stats.packets_received - published.packets_received;
+  published = default_conn.stats;
+}
+
+void A_output(struct msg message)
+{
+  sr_A_output(&default_conn, message);
+  publish_stats();
+}
+
+int A_output_batch(const struct msg *messages, int n)
+{
+  int accepted = sr_A_output_batch(&default_conn, messages, n);
+
+  publish_stats();
+  return accepted;
+}
+
+void A_input(struct pkt packet)
+{
+  sr_A_input(&default_conn, packet);
+  publish_stats();
+}
+
+void A_input_batch(const struct pkt *packets, int n)
+{
+  sr_A_input_batch(&default_conn, packets, n);
+  publish_stats();
+}
+
+void A_timerinterrupt(void)
+{
+  sr_A_timerinterrupt(&default_conn);
+  publish_stats();
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init(void)
+{
+  default_conn.config = config;
+  default_conn.ops = &emulator_ops;
+  if (!sender_init(&default_conn, A) || !receiver_init(&default_conn, A)) {
+    fprintf(stderr, "sr: cannot allocate buffers for a window of %d\n", config.windowsize);
+    exit(1);
+  }
+}
 
-  if (TRACE > 0)
-    printf("----B: Timeout, resending packets!\n");
+void B_input(struct pkt packet)
+{
+  sr_B_input(&default_conn, packet);
+  publish_stats();
+}
 
-  for (i = 0; i < B_windowcount; i++) {
-    if (TRACE > 0)
-      printf("---B: resending packet %d\n", B_buffer[(B_windowfirst + i) % WINDOWSIZE].seqnum);
+void B_input_batch(const struct pkt *packets, int n)
+{
+  sr_B_input_batch(&default_conn, packets, n);
+  publish_stats();
+}
 
-    tolayer3(B, B_buffer[(B_windowfirst + i) % WINDOWSIZE]);
-    if (i == 0) starttimer(B, timeout_ticks);
+/* the following routine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+void B_init(void)
+{
+  default_conn.config = config;
+  default_conn.ops = &emulator_ops;
+  if (!receiver_init(&default_conn, B) || !sender_init(&default_conn, B)) {
+    fprintf(stderr, "sr: cannot allocate buffers for a window of %d\n", config.windowsize);
+    exit(1);
   }
 }
 
+void B_output(struct msg message)
+{
+  sr_B_output(&default_conn, message);
+  publish_stats();
+}
+
+int B_output_batch(const struct msg *messages, int n)
+{
+  int accepted = sr_B_output_batch(&default_conn, messages, n);
+
+  publish_stats();
+  return accepted;
+}
+
+void B_timerinterrupt(void)
+{
+  sr_B_timerinterrupt(&default_conn);
+  publish_stats();
+}
@@ -1,3 +1,27 @@
+/* packet checksums, both ends of a connection must use the same one */
+#define SR_CHECKSUM_SUM    0   /* the original additive ComputeChecksum() */
+#define SR_CHECKSUM_CRC32C 1   /* CRC32C over header and payload */
+
+/* run time configuration, set with sr_configure() before A_init() and B_init() */
+struct sr_config {
+  int windowsize;          /* the maximum number of buffered unacked packets */
+  unsigned int seqspace;   /* sequence numbers run 0..seqspace-1, at most 2^31, 0 = 2^31 */
+  int checksum;            /* SR_CHECKSUM_SUM or SR_CHECKSUM_CRC32C */
+  int ackdelay;            /* ticks an ACK may be held to coalesce it with later ones or, in
+                              bidirectional mode, to ride on data going back, 0 = ACK every packet */
+  int ackevery;            /* with ackdelay, ACK once this many packets wait, 0 = every second packet */
+  int backlog;             /* messages each end queues while its window is full, 0 = drop them */
+  int timeout;             /* initial retransmission timeout in ticks until RTT samples arrive, 0 = 24 */
+  int fec;                 /* send an XOR parity packet after every fec new packets, at most
+                              windowsize, so one loss in the group is rebuilt, 0 = off */
+  int rsrepair;            /* on a timeout send Reed-Solomon repair packets over the window
+                              instead of resending, this many more than the packets timing
+                              out so some may be lost as well, 0 = off */
+  int fragment;            /* messages go in with sr_send() and come out whole through
+                              ops->deliver, whatever their size, 0 = one struct msg each */
+};
+extern int sr_configure(const struct sr_config *config);
+
 extern void A_init(void);
 extern void B_init(void);
 extern void A_input(struct pkt);
@@ -5,7 +29,109 @@ extern void B_input(struct pkt);
 extern void A_output(struct msg);
 extern void A_timerinterrupt(void);
 
+/* send messages[0..n-1] as n calls of A_output() would, but fill the free
+   window in one pass and hand its packets to the lower layer together.
+   Returns how many were sent or queued, the rest were dropped. */
+extern int A_output_batch(const struct msg *messages, int n);
+
+/* take packets[0..n-1] as n calls of B_input() would, but check their
+   checksums in one loop, deliver the run of messages they complete at
+   once and send one ACK that covers them all */
+extern void B_input_batch(const struct pkt *packets, int n);
+
 /* included for extension to bidirectional communication */
 #define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
 extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+extern void B_timerinterrupt(void);
+extern int B_output_batch(const struct msg *messages, int n);
+extern void A_input_batch(const struct pkt *packets, int n);
+
+/* One connection per struct sr_conn. The functions above drive a default
+   connection through the emulator, the sr_ functions below drive any
+   connection through its own struct sr_ops. */
+struct sr_conn;
+
+/* how a connection reaches its lower layer, application and timers, these
+   mirror tolayer3(), tolayer5(), starttimer(), stoptimer() and currenttime() */
+struct sr_ops {
+  void (*tolayer3)(void *user, int AorB, const struct pkt *packet);
+  void (*tolayer5)(void *user, int AorB, char *data);
+  void (*starttimer)(void *user, int AorB, float increment);
+  void (*stoptimer)(void *user, int AorB);
+  double (*now)(void *user);
+  /* with config.fragment, called with each reassembled message instead of tolayer5 */
+  void (*deliver)(void *user, int AorB, const char *data, size_t len);
+  /* optional, the packets of one output batch in a single call, NULL = one tolayer3 each */
+  void (*tolayer3_batch)(void *user, int AorB, const struct pkt *const *packets, int n);
+  /* optional, a run of in order messages of PAYLOADSIZE bytes in a single call,
+     NULL = one tolayer5 each */
+  void (*tolayer5_batch)(void *user, int AorB, char *const *data, int n);
+};
+
+/* per connection counters, both directions together in bidirectional mode.
+   The default connection adds them to the emulator's. */
+struct sr_stats {
+  int window_full;         /* messages dropped because the window and backlog were full, at A or B */
+  int backlogged;          /* messages queued because the window was full */
+  int total_ACKs_received; /* uncorrupted ACKs received, bare or on data */
+  int new_ACKs;            /* of them, ACKs that acknowledged at least one packet */
+  int packets_received;    /* uncorrupted data packets received, duplicates included */
+  int packets_resent;      /* packets resent after a timeout */
+  int packets_sent;        /* packets sent for the first time */
+  int packets_acked;       /* packets acknowledged, by their own ACK or a selective one */
+  int dup_ACKs;            /* uncorrupted ACKs that acknowledged nothing new */
+  int corrupt_dropped;     /* corrupted packets discarded, at A or B */
+  int out_of_window;       /* uncorrupted data packets discarded outside the receive window */
+  int delivered;           /* messages passed to layer 5 */
+  int fec_sent;            /* parity packets sent, see config.fec */
+  int fec_recovered;       /* lost data packets rebuilt from parity, also in packets_received */
+  int rs_sent;             /* Reed-Solomon repair packets sent, see config.rsrepair */
+  int rs_recovered;        /* lost data packets decoded from repair packets, also in packets_received */
+  int reassembled;         /* messages passed to ops->deliver, see config.fragment; delivered
+                              counts their fragments */
+};
+
+/* Log-linear histogram of non-negative integers, in the manner of
+   HdrHistogram: values below SR_HIST_SUB are counted exactly, larger
+   ones in SR_HIST_SUB buckets per power of two, so within 1/16. */
+#define SR_HIST_SUBBITS 4
+#define SR_HIST_SUB (1 << SR_HIST_SUBBITS)
+#define SR_HIST_BUCKETS (SR_HIST_SUB * (33 - SR_HIST_SUBBITS))
+struct sr_histogram {
+  unsigned long count;
+  double sum;
+  unsigned long max;
+  unsigned long buckets[SR_HIST_BUCKETS];
+};
+
+/* per connection histograms, kept apart from struct sr_stats which is cheap to copy */
+struct sr_histograms {
+  struct sr_histogram ack_latency; /* ticks from a packet's first send to its acknowledgement */
+  struct sr_histogram window;      /* packets outstanding at the sender, sampled on every send */
+};
+
+extern struct sr_conn *sr_conn_create(const struct sr_config *config, const struct sr_ops *ops, void *user);
+extern void sr_conn_destroy(struct sr_conn *conn);
+extern const struct sr_stats *sr_conn_stats(const struct sr_conn *conn);
+extern const struct sr_histograms *sr_conn_histograms(const struct sr_conn *conn);
+/* the connection A_init(), A_output() and friends drive */
+extern const struct sr_conn *sr_default_conn(void);
+
+extern void sr_A_output(struct sr_conn *conn, struct msg message);
+extern int sr_A_output_batch(struct sr_conn *conn, const struct msg *messages, int n);
+extern void sr_A_input(struct sr_conn *conn, struct pkt packet);
+extern void sr_A_input_batch(struct sr_conn *conn, const struct pkt *packets, int n);
+extern void sr_A_timerinterrupt(struct sr_conn *conn);
+extern void sr_B_input(struct sr_conn *conn, struct pkt packet);
+extern void sr_B_input_batch(struct sr_conn *conn, const struct pkt *packets, int n);
+extern void sr_B_output(struct sr_conn *conn, struct msg message);
+extern int sr_B_output_batch(struct sr_conn *conn, const struct msg *messages, int n);
+extern void sr_B_timerinterrupt(struct sr_conn *conn);
+
+/* With config.fragment, every message carries an SR_FRAGHEADER byte header
+   and sr_send() splits a message of any length into SR_FRAGDATA byte
+   fragments, one packet each.  Returns -1 and sends nothing when the free
+   window and backlog cannot take all of them, 0 otherwise. */
+#define SR_FRAGHEADER 3
+#define SR_FRAGDATA (PAYLOADSIZE - SR_FRAGHEADER)
+extern int sr_send(struct sr_conn *conn, int AorB, const void *data, size_t len);
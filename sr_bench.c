@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sim.h"
+#include "sr_sim.h"
+#include "erasure.h"
+
+/* ******************************************************************
+   Goodput and latency benchmark for the SR protocol.
+
+   Offers messages to A at a fixed rate (-t, the mean time between
+   messages) and runs the same fixed matrix of loss and corruption rates
+   every time, so results can be compared from one build to the next.
+   Runs are simulated and seeded, so the same build and options always
+   give the same numbers.
+
+   Prints one JSON object per line for every point of the matrix, and
+   exits non-zero if any run lost, duplicated or reordered a message, or
+   if the run with no loss and no corruption on the queueing channel
+   sent more resends and repair packets than it accepted messages
+   (every one is spurious, so the timeout is not backing off).  One more
+   such run follows the matrix with a window of GATEWINDOW offered a
+   message every GATEINTERVAL, far more than the channel carries, so
+   its round trip grows as the window queues on the channel.  It runs
+   once more with B offering messages too, unless -2 already does, as
+   the data B sends queues in front of A's ACKs.
+
+   The retransmission ratio counts every packet sent on top of the
+   first copy of each message: resends, parity packets (-k) and
+   Reed-Solomon repair packets (-r), so runs with and without them
+   compare fairly.
+
+   Build and run, for example
+     gcc -O2 -pthread -o sr_bench sr_bench.c sr_sim.c sim.c sr.c checksum.c erasure.c sr_trace.c -lm
+     ./sr_bench -t 2 -w 16 > bench.jsonl
+**********************************************************************/
+
+static const double losses[] = { 0.0, 0.01, 0.05, 0.1, 0.2, 0.3 };
+static const double corruptions[] = { 0.0, 0.05, 0.1 };
+
+#define NLOSSES (sizeof(losses) / sizeof(losses[0]))
+#define NCORRUPTIONS (sizeof(corruptions) / sizeof(corruptions[0]))
+
+#define GATEWINDOW 1000   /* with -r at most RS_MAXSYMBOLS - RS_MAXREPAIR */
+#define GATEINTERVAL 0.5
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-t interval] [-n msgs] [-w window] [-q seqspace] [-b backlog]\n"
+         "          [-a ackdelay] [-k fec] [-r rsrepair] [-B burst] [-f] [-2] [-s seed]\n"
+         "  -t  mean time between messages offered to A, the offered load is 1/interval\n"
+         "  -q  sequence space, default twice the window, 0 = the largest, 2^31\n"
+         "  -k  send a parity packet after every fec packets, at most the window\n"
+         "  -r  resend as Reed-Solomon repair packets, rsrepair more than timed out\n"
+         "  -B  mean length of loss bursts, losses are independent by default\n"
+         "  -f  packets do not queue behind each other on the channel\n"
+         "  -2  bidirectional, B offers messages at the same rate as A\n", prog);
+}
+
+/* packets per message accepted */
+static double per_message(const struct sr_sim_result *r, long packets)
+{
+  long accepted = r->sim.generated - r->sim.dropped;
+
+  return accepted > 0 ? (double)packets / accepted : 0.0;
+}
+
+/* resent, parity and repair packets per message accepted */
+static double retransmission_ratio(const struct sr_sim_result *r)
+{
+  return per_message(r, (long)r->conn.packets_resent + r->conn.fec_sent + r->conn.rs_sent);
+}
+
+static void report(const struct sim_params *p, const struct sr_config *config,
+                   const struct sr_sim_result *r)
+{
+
+  printf("{\"loss\": %g, \"corrupt\": %g, \"offered_load\": %g, \"window\": %d, \"seqspace\": %u, "
+         "\"fec\": %d, \"rsrepair\": %d, \"ok\": %s, \"generated\": %ld, \"window_full\": %ld, \"delivered\": %ld, "
+         "\"time\": %.3f, \"goodput\": %.6f, \"packets_sent\": %ld, \"packets_resent\": %d, "
+         "\"fec_sent\": %d, \"rs_sent\": %d, "
+         "\"retransmission_ratio\": %.6f, \"latency_mean\": %.3f, \"latency_p50\": %.3f, "
+         "\"latency_p99\": %.3f, \"latency_p999\": %.3f, \"latency_max\": %.3f}\n",
+         p->lossprob, p->corruptprob, 1.0 / p->msginterval, config->windowsize, config->seqspace,
+         config->fec, config->rsrepair, r->ok ? "true" : "false", r->sim.generated, r->sim.dropped, r->sim.delivered,
+         r->sim.endtime, r->sim.endtime > 0 ? r->sim.delivered / r->sim.endtime : 0.0,
+         r->sim.sent, r->conn.packets_resent, r->conn.fec_sent, r->conn.rs_sent,
+         retransmission_ratio(r),
+         r->sim.delivered > 0 ? r->sim.latency_sum / r->sim.delivered : 0.0,
+         r->p50, r->p99, r->p999, r->sim.latency_max);
+}
+
+/* run one point and report it, 1 if it failed, 2 if it could not run */
+static int run(const struct sim_params *params, const struct sr_config *config)
+{
+  struct sr_sim_result result;
+  double spurious;
+  int failed = 0;
+
+  if (sr_sim_run(params, config, &result) != 0) {
+    fprintf(stderr, "sr_bench: cannot run window %d sequence space %u\n",
+            config->windowsize, config->seqspace);
+    return 2;
+  }
+  report(params, config, &result);
+  if (!result.ok)
+    failed = 1;
+  /* parity packets go out whatever the timeout does, resends and repairs only on timeouts */
+  spurious = per_message(&result, (long)result.conn.packets_resent + result.conn.rs_sent);
+  if (params->lossprob == 0 && params->corruptprob == 0 && params->serialise && spurious > 1.0) {
+    fprintf(stderr, "sr_bench: %.2f resends and repairs per message with nothing lost\n", spurious);
+    failed = 1;
+  }
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  struct sim_params params;
+  struct sr_config config;
+  long seqspace = -1;
+  size_t li, ci;
+  int i, rc;
+  int failed = 0;
+
+  sim_default_params(&params);
+  params.nmsgs = 20000;
+  params.msginterval = 10.0;
+  memset(&config, 0, sizeof(config));
+  config.windowsize = 6;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0) {
+      params.serialise = 0;
+      continue;
+    }
+    if (strcmp(argv[i], "-2") == 0) {
+      params.bidirectional = 1;
+      continue;
+    }
+    if (i + 1 >= argc || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+      usage(argv[0]);
+      return 2;
+    }
+    switch (argv[i++][1]) {
+    case 't': params.msginterval = atof(argv[i]); break;
+    case 'n': params.nmsgs = atol(argv[i]); break;
+    case 'w': config.windowsize = atoi(argv[i]); break;
+    case 'q': seqspace = atol(argv[i]); break;
+    case 'b': config.backlog = atoi(argv[i]); break;
+    case 'a': config.ackdelay = atoi(argv[i]); break;
+    case 'k': config.fec = atoi(argv[i]); break;
+    case 'r': config.rsrepair = atoi(argv[i]); break;
+    case 'B': params.lossburst = atof(argv[i]); break;
+    case 's': params.seed = strtoul(argv[i], NULL, 10); break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  config.seqspace = seqspace < 0 ? 2 * (unsigned int)config.windowsize : (unsigned int)seqspace;
+  if (params.msginterval <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  for (li = 0; li < NLOSSES; li++)
+    for (ci = 0; ci < NCORRUPTIONS; ci++) {
+      params.lossprob = losses[li];
+      params.corruptprob = corruptions[ci];
+      rc = run(&params, &config);
+      if (rc == 2)
+        return 2;
+      failed |= rc;
+    }
+
+  /* the matrix's window seldom fills, a large one shows whether the timeout
+     keeps up with a round trip that grows as the window queues */
+  params.lossprob = 0;
+  params.corruptprob = 0;
+  params.msginterval = GATEINTERVAL;
+  config.windowsize = config.rsrepair > 0 ? RS_MAXSYMBOLS - RS_MAXREPAIR : GATEWINDOW;
+  config.seqspace = seqspace == 0 ? 0 : 2 * (unsigned int)config.windowsize;
+  for (; params.bidirectional <= 1; params.bidirectional++) {
+    rc = run(&params, &config);
+    if (rc == 2)
+      return 2;
+    failed |= rc;
+  }
+  return failed;
+}
@@ -0,0 +1,614 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sr_engine.h"
+
+/* ******************************************************************
+   Sharded session engine.  Needs C11 atomics and POSIX threads.
+
+   Each shard is one worker thread with its own connection table, its own
+   timer heap and one inbound ring per producer.  A ring has exactly one
+   writer and one reader, so it needs no locks: the writer publishes the
+   tail with a release store and the reader publishes the head the same way.
+**********************************************************************/
+
+#define CACHELINE 64
+#define DRAINBATCH 64     /* events taken from one ring before looking at the next */
+#define IDLESLEEPNS 50000 /* longest nap when a shard has nothing to do */
+
+#define EV_OUTPUT 0
+#define EV_INPUT 1
+#define EV_CLOSE 2
+
+struct engine_event {
+  int kind;
+  int AorB;
+  unsigned long conn_id;
+  union {
+    struct msg message;
+    struct pkt packet;
+  } u;
+};
+
+struct ring {
+  _Alignas(CACHELINE) atomic_size_t head;   /* next event the shard reads */
+  _Alignas(CACHELINE) atomic_size_t tail;   /* next free slot for the producer */
+  _Alignas(CACHELINE) size_t mask;
+  struct engine_event *events;
+};
+
+struct shard;
+
+struct session {
+  unsigned long id;
+  struct sr_conn *conn;
+  struct shard *shard;
+  unsigned long timer_id[2];   /* running timer of A and B, 0 = stopped */
+  bool timer_lost;             /* a timer could not be queued, the connection would stall */
+  struct session *next;        /* hash chain */
+};
+
+struct timer {
+  long due;                    /* shard tick the timer fires at */
+  unsigned long conn_id;
+  unsigned long timer_id;      /* stale once the session restarts or stops that timer */
+  int AorB;
+};
+
+struct shard {
+  struct sr_engine *engine;
+  int index;
+  pthread_t thread;
+  struct ring *rings;          /* one per producer */
+
+  struct session **buckets;
+  size_t nbuckets, nsessions;
+
+  struct timer *heap;
+  size_t nheap, heapsize;
+  unsigned long next_timer_id;
+  long now;                    /* current tick */
+};
+
+struct sr_engine {
+  struct sr_engine_config config;
+  struct sr_engine_callbacks callbacks;
+  void *user;
+  int nrings;                  /* external producers plus one per shard */
+  struct shard *shards;
+  atomic_int running;
+  struct timespec start;
+};
+
+static _Thread_local const struct sr_engine *self_engine;
+static _Thread_local int self_producer = -1;
+
+
+/********* SPSC rings ************/
+
+static bool ring_init(struct ring *r, int size)
+{
+  size_t n = 1;
+
+  while (n < (size_t)size)
+    n <<= 1;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  r->mask = n - 1;
+  r->events = malloc(n * sizeof(struct engine_event));
+  return r->events != NULL;
+}
+
+static bool ring_push(struct ring *r, const struct engine_event *ev)
+{
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+  if (tail - head > r->mask)
+    return false;
+  r->events[tail & r->mask] = *ev;
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+static bool ring_pop(struct ring *r, struct engine_event *ev)
+{
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+  if (head == tail)
+    return false;
+  *ev = r->events[head & r->mask];
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return true;
+}
+
+
+/********* Connection table, owned by one shard ************/
+
+/* spread connection ids over shards and buckets (splitmix64 finaliser) */
+static unsigned long long mix(unsigned long id)
+{
+  unsigned long long x = id;
+
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static struct session *find_session(struct shard *sh, unsigned long id)
+{
+  struct session *s;
+
+  for (s = sh->buckets[(mix(id) >> 32) & (sh->nbuckets - 1)]; s != NULL; s = s->next)
+    if (s->id == id)
+      return s;
+  return NULL;
+}
+
+static bool grow_table(struct shard *sh)
+{
+  struct session **buckets;
+  struct session *s, *next;
+  size_t n = sh->nbuckets * 2;
+  size_t i, b;
+
+  buckets = calloc(n, sizeof(struct session *));
+  if (buckets == NULL)
+    return false;
+  for (i = 0; i < sh->nbuckets; i++)
+    for (s = sh->buckets[i]; s != NULL; s = next) {
+      next = s->next;
+      b = (mix(s->id) >> 32) & (n - 1);
+      s->next = buckets[b];
+      buckets[b] = s;
+    }
+  free(sh->buckets);
+  sh->buckets = buckets;
+  sh->nbuckets = n;
+  return true;
+}
+
+static void session_tolayer3(void *user, int AorB, const struct pkt *packet)
+{
+  struct session *s = user;
+  struct sr_engine *e = s->shard->engine;
+
+  e->callbacks.tolayer3(e->user, s->id, AorB, packet);
+}
+
+static void session_tolayer5(void *user, int AorB, char *data)
+{
+  struct session *s = user;
+  struct sr_engine *e = s->shard->engine;
+
+  e->callbacks.tolayer5(e->user, s->id, AorB, data);
+}
+
+static bool heap_push(struct shard *sh, const struct timer *t);
+
+static void session_starttimer(void *user, int AorB, float increment)
+{
+  struct session *s = user;
+  struct shard *sh = s->shard;
+  struct timer t;
+
+  t.due = sh->now + (long)increment;
+  if (t.due < sh->now + increment || t.due == sh->now)
+    t.due++;
+  t.conn_id = s->id;
+  t.timer_id = ++sh->next_timer_id;
+  t.AorB = AorB;
+  s->timer_id[AorB] = t.timer_id;
+  if (!heap_push(sh, &t)) {
+    s->timer_id[AorB] = 0;
+    s->timer_lost = true;
+  }
+}
+
+static void session_stoptimer(void *user, int AorB)
+{
+  struct session *s = user;
+
+  /* the heap entry stays behind and is skipped when it comes up */
+  s->timer_id[AorB] = 0;
+}
+
+static double session_now(void *user)
+{
+  return (double)((struct session *)user)->shard->now;
+}
+
+static const struct sr_ops session_ops = {
+  session_tolayer3, session_tolayer5, session_starttimer, session_stoptimer, session_now,
+  NULL, NULL, NULL
+};
+
+static struct session *get_session(struct shard *sh, unsigned long id)
+{
+  struct session *s = find_session(sh, id);
+  size_t b;
+
+  if (s != NULL)
+    return s;
+  if (sh->nsessions >= sh->nbuckets && !grow_table(sh))
+    return NULL;
+  s = calloc(1, sizeof(struct session));
+  if (s == NULL)
+    return NULL;
+  s->id = id;
+  s->shard = sh;
+  s->conn = sr_conn_create(&sh->engine->config.conn, &session_ops, s);
+  if (s->conn == NULL) {
+    free(s);
+    return NULL;
+  }
+  b = (mix(id) >> 32) & (sh->nbuckets - 1);
+  s->next = sh->buckets[b];
+  sh->buckets[b] = s;
+  sh->nsessions++;
+  return s;
+}
+
+static void close_session(struct shard *sh, unsigned long id)
+{
+  struct session **pp = &sh->buckets[(mix(id) >> 32) & (sh->nbuckets - 1)];
+  struct session *s;
+
+  for (; *pp != NULL; pp = &(*pp)->next)
+    if ((*pp)->id == id) {
+      s = *pp;
+      *pp = s->next;
+      sr_conn_destroy(s->conn);
+      free(s);
+      sh->nsessions--;
+      return;
+    }
+}
+
+
+/********* Timer heap, ordered by due tick ************/
+
+/* returns false when the heap cannot grow, the timer is not queued */
+static bool heap_push(struct shard *sh, const struct timer *t)
+{
+  struct timer *heap;
+  size_t i, parent;
+
+  if (sh->nheap == sh->heapsize) {
+    heap = realloc(sh->heap, 2 * sh->heapsize * sizeof(struct timer));
+    if (heap == NULL)
+      return false;
+    sh->heap = heap;
+    sh->heapsize *= 2;
+  }
+  i = sh->nheap++;
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (sh->heap[parent].due <= t->due)
+      break;
+    sh->heap[i] = sh->heap[parent];
+    i = parent;
+  }
+  sh->heap[i] = *t;
+  return true;
+}
+
+static void heap_pop(struct shard *sh)
+{
+  struct timer last = sh->heap[--sh->nheap];
+  size_t i = 0, child;
+
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= sh->nheap)
+      break;
+    if (child + 1 < sh->nheap && sh->heap[child + 1].due < sh->heap[child].due)
+      child++;
+    if (last.due <= sh->heap[child].due)
+      break;
+    sh->heap[i] = sh->heap[child];
+    i = child;
+  }
+  if (sh->nheap > 0)
+    sh->heap[i] = last;
+}
+
+/* a connection whose timer could not be queued would wait for it forever,
+   close it instead */
+static void check_timers(struct shard *sh, struct session *s)
+{
+  if (!s->timer_lost)
+    return;
+  fprintf(stderr, "sr_engine: out of memory for timers, connection %lu closed\n", s->id);
+  close_session(sh, s->id);
+}
+
+/* fire every timer due by now, returns how many fired */
+static int run_timers(struct shard *sh)
+{
+  struct timer t;
+  struct session *s;
+  int fired = 0;
+
+  while (sh->nheap > 0 && sh->heap[0].due <= sh->now) {
+    t = sh->heap[0];
+    heap_pop(sh);
+    s = find_session(sh, t.conn_id);
+    if (s == NULL || s->timer_id[t.AorB] != t.timer_id)
+      continue;
+    s->timer_id[t.AorB] = 0;
+    if (t.AorB == A)
+      sr_A_timerinterrupt(s->conn);
+    else
+      sr_B_timerinterrupt(s->conn);
+    check_timers(sh, s);
+    fired++;
+  }
+  return fired;
+}
+
+
+/********* Shard run loop ************/
+
+static long ticks_since_start(const struct sr_engine *e)
+{
+  struct timespec now;
+  long long ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ns = (long long)(now.tv_sec - e->start.tv_sec) * 1000000000LL + (now.tv_nsec - e->start.tv_nsec);
+  return (long)(ns / e->config.tick_ns);
+}
+
+static void handle_event(struct shard *sh, const struct engine_event *ev)
+{
+  struct session *s;
+
+  if (ev->kind == EV_CLOSE) {
+    close_session(sh, ev->conn_id);
+    return;
+  }
+  if (ev->kind == EV_INPUT) {
+    /* only output opens a connection, late packets must not bring a closed one back */
+    s = find_session(sh, ev->conn_id);
+    if (s == NULL)
+      return;
+    if (ev->AorB == A)
+      sr_A_input(s->conn, ev->u.packet);
+    else
+      sr_B_input(s->conn, ev->u.packet);
+  } else {
+    s = get_session(sh, ev->conn_id);
+    if (s == NULL) {
+      fprintf(stderr, "sr_engine: cannot create connection %lu\n", ev->conn_id);
+      return;
+    }
+    if (ev->AorB == A)
+      sr_A_output(s->conn, ev->u.message);
+    else
+      sr_B_output(s->conn, ev->u.message);
+  }
+  check_timers(sh, s);
+}
+
+static void *shard_main(void *arg)
+{
+  struct shard *sh = arg;
+  struct sr_engine *e = sh->engine;
+  struct engine_event ev;
+  struct timespec nap;
+  int i, n, work;
+#ifdef __linux__
+  cpu_set_t cpus;
+
+  if (e->config.pin_threads) {
+    CPU_ZERO(&cpus);
+    CPU_SET(sh->index % CPU_SETSIZE, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#endif
+
+  self_engine = e;
+  self_producer = e->config.nproducers + sh->index;
+
+  while (atomic_load_explicit(&e->running, memory_order_relaxed)) {
+    work = 0;
+    /* connections read the clock and start timers from it, keep it current */
+    for (i = 0; i < e->nrings; i++) {
+      sh->now = ticks_since_start(e);
+      for (n = 0; n < DRAINBATCH && ring_pop(&sh->rings[i], &ev); n++) {
+        handle_event(sh, &ev);
+        work++;
+      }
+    }
+
+    sh->now = ticks_since_start(e);
+    work += run_timers(sh);
+
+    if (work == 0) {
+      nap.tv_sec = 0;
+      nap.tv_nsec = e->config.tick_ns < IDLESLEEPNS ? e->config.tick_ns : IDLESLEEPNS;
+      nanosleep(&nap, NULL);
+    }
+  }
+  return NULL;
+}
+
+
+/********* Engine lifetime and producer side ************/
+
+struct sr_engine *sr_engine_create(const struct sr_engine_config *config,
+                                   const struct sr_engine_callbacks *callbacks, void *user)
+{
+  struct sr_engine *e;
+  struct shard *sh;
+  int i, j;
+
+  if (config->nproducers < 0 || config->ringsize < 1 || config->tick_ns < 1)
+    return NULL;
+  e = calloc(1, sizeof(struct sr_engine));
+  if (e == NULL)
+    return NULL;
+  e->config = *config;
+  if (e->config.nshards <= 0)
+    e->config.nshards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (e->config.nshards <= 0)
+    e->config.nshards = 1;
+  e->callbacks = *callbacks;
+  e->user = user;
+  e->nrings = e->config.nproducers + e->config.nshards;
+  atomic_init(&e->running, 0);
+
+  e->shards = calloc(e->config.nshards, sizeof(struct shard));
+  if (e->shards == NULL) {
+    free(e);
+    return NULL;
+  }
+  for (i = 0; i < e->config.nshards; i++) {
+    sh = &e->shards[i];
+    sh->engine = e;
+    sh->index = i;
+    sh->nbuckets = 64;
+    sh->buckets = calloc(sh->nbuckets, sizeof(struct session *));
+    sh->heapsize = 64;
+    sh->heap = malloc(sh->heapsize * sizeof(struct timer));
+    sh->rings = aligned_alloc(CACHELINE, e->nrings * sizeof(struct ring));
+    if (sh->buckets == NULL || sh->heap == NULL || sh->rings == NULL) {
+      sr_engine_destroy(e);
+      return NULL;
+    }
+    memset(sh->rings, 0, e->nrings * sizeof(struct ring));
+    for (j = 0; j < e->nrings; j++)
+      if (!ring_init(&sh->rings[j], config->ringsize)) {
+        sr_engine_destroy(e);
+        return NULL;
+      }
+  }
+  return e;
+}
+
+int sr_engine_start(struct sr_engine *e)
+{
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &e->start);
+  atomic_store(&e->running, 1);
+  for (i = 0; i < e->config.nshards; i++)
+    if (pthread_create(&e->shards[i].thread, NULL, shard_main, &e->shards[i]) != 0) {
+      fprintf(stderr, "sr_engine: cannot start shard %d\n", i);
+      atomic_store(&e->running, 0);
+      while (--i >= 0)
+        pthread_join(e->shards[i].thread, NULL);
+      return -1;
+    }
+  return 0;
+}
+
+void sr_engine_stop(struct sr_engine *e)
+{
+  int i;
+
+  if (!atomic_exchange(&e->running, 0))
+    return;
+  for (i = 0; i < e->config.nshards; i++)
+    pthread_join(e->shards[i].thread, NULL);
+}
+
+void sr_engine_destroy(struct sr_engine *e)
+{
+  struct shard *sh;
+  struct session *s, *next;
+  size_t b;
+  int i, j;
+
+  if (e == NULL)
+    return;
+  sr_engine_stop(e);
+  for (i = 0; i < e->config.nshards; i++) {
+    sh = &e->shards[i];
+    if (sh->buckets != NULL)
+      for (b = 0; b < sh->nbuckets; b++)
+        for (s = sh->buckets[b]; s != NULL; s = next) {
+          next = s->next;
+          sr_conn_destroy(s->conn);
+          free(s);
+        }
+    if (sh->rings != NULL)
+      for (j = 0; j < e->nrings; j++)
+        free(sh->rings[j].events);
+    free(sh->rings);
+    free(sh->buckets);
+    free(sh->heap);
+  }
+  free(e->shards);
+  free(e);
+}
+
+int sr_engine_shard_of(const struct sr_engine *e, unsigned long conn_id)
+{
+  return (int)(mix(conn_id) % (unsigned long long)e->config.nshards);
+}
+
+int sr_engine_nshards(const struct sr_engine *e)
+{
+  return e->config.nshards;
+}
+
+int sr_engine_self(const struct sr_engine *e)
+{
+  return self_engine == e ? self_producer : -1;
+}
+
+static int submit(struct sr_engine *e, int producer, const struct engine_event *ev)
+{
+  if (producer < 0 || producer >= e->nrings)
+    return -1;
+  return ring_push(&e->shards[sr_engine_shard_of(e, ev->conn_id)].rings[producer], ev) ? 0 : -1;
+}
+
+int sr_engine_output(struct sr_engine *e, int producer, unsigned long conn_id,
+                     int AorB, const struct msg *message)
+{
+  struct engine_event ev;
+
+  ev.kind = EV_OUTPUT;
+  ev.AorB = AorB;
+  ev.conn_id = conn_id;
+  ev.u.message = *message;
+  return submit(e, producer, &ev);
+}
+
+int sr_engine_input(struct sr_engine *e, int producer, unsigned long conn_id,
+                    int AorB, const struct pkt *packet)
+{
+  struct engine_event ev;
+
+  ev.kind = EV_INPUT;
+  ev.AorB = AorB;
+  ev.conn_id = conn_id;
+  ev.u.packet = *packet;
+  return submit(e, producer, &ev);
+}
+
+int sr_engine_close(struct sr_engine *e, int producer, unsigned long conn_id)
+{
+  struct engine_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.kind = EV_CLOSE;
+  ev.conn_id = conn_id;
+  return submit(e, producer, &ev);
+}
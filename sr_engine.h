@@ -0,0 +1,48 @@
+/* Sharded session engine: runs many SR connections across worker threads.
+   Include after emulator.h and sr.h, like sr.h itself.
+
+   Every connection id is pinned to one shard (worker thread) by a hash of the
+   id, and only that shard ever touches the connection, so shards never
+   contend on protocol state.  Work reaches a shard through single-producer
+   single-consumer rings: each external producer and each shard owns one ring
+   into every shard.  Callbacks run on the shard thread that owns the
+   connection and may hand packets to other connections with
+   sr_engine_input(engine, sr_engine_self(engine), ...). */
+
+struct sr_engine;
+
+/* how the engine reaches the lower layer and the application of a connection */
+struct sr_engine_callbacks {
+  void (*tolayer3)(void *user, unsigned long conn_id, int AorB, const struct pkt *packet);
+  void (*tolayer5)(void *user, unsigned long conn_id, int AorB, char *data);
+};
+
+struct sr_engine_config {
+  int nshards;             /* worker threads, 0 = one per online CPU */
+  int nproducers;          /* external threads calling sr_engine_input()/_output() */
+  int ringsize;            /* events per ring, rounded up to a power of two */
+  long tick_ns;            /* wall clock length of one protocol tick in nanoseconds */
+  int pin_threads;         /* 1 = pin shard i to CPU i */
+  struct sr_config conn;   /* window and sequence space of every connection */
+};
+
+extern struct sr_engine *sr_engine_create(const struct sr_engine_config *config,
+                                          const struct sr_engine_callbacks *callbacks, void *user);
+extern int sr_engine_start(struct sr_engine *engine);
+extern void sr_engine_stop(struct sr_engine *engine);
+extern void sr_engine_destroy(struct sr_engine *engine);
+
+/* Queue work for a connection.  Output creates the connection on first use,
+   input for a connection that was never opened or has been closed is dropped.
+   producer is the caller's ring, 0..nproducers-1 for external threads or
+   sr_engine_self() from a callback.  Returns -1 when that ring is full. */
+extern int sr_engine_output(struct sr_engine *engine, int producer, unsigned long conn_id,
+                            int AorB, const struct msg *message);
+extern int sr_engine_input(struct sr_engine *engine, int producer, unsigned long conn_id,
+                           int AorB, const struct pkt *packet);
+extern int sr_engine_close(struct sr_engine *engine, int producer, unsigned long conn_id);
+
+extern int sr_engine_shard_of(const struct sr_engine *engine, unsigned long conn_id);
+extern int sr_engine_nshards(const struct sr_engine *engine);
+/* producer id of the calling shard thread, -1 outside the engine's threads */
+extern int sr_engine_self(const struct sr_engine *engine);
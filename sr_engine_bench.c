@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sr_engine.h"
+
+/* ******************************************************************
+   End to end run of the sharded session engine.
+
+   Opens -N connections and offers -n messages to A on every one from a
+   single producer thread.  Each connection's lower layer is a loopback
+   that loses and corrupts packets at the given rates and hands the rest
+   straight back to the engine for the other end.  Messages are paced so
+   a connection never has more than a window outstanding, so none are
+   dropped for a full window and every one must arrive.
+
+   Once all are delivered every connection is closed and a stale packet
+   is sent to it, and to as many connections that were never opened; the
+   engine must drop all of them.
+
+   Prints the delivery rate and exits non-zero if any message was lost,
+   duplicated, reordered or corrupted, or a stale packet was delivered.
+
+   Build and run, for example
+     gcc -O2 -pthread -o sr_engine_bench sr_engine_bench.c sr_engine.c sr_sim.c sim.c sr.c \
+         checksum.c erasure.c sr_trace.c -lm
+     ./sr_engine_bench -N 1000 -n 200 -l 0.1 -c 0.05
+**********************************************************************/
+
+/* sr_sim.c provides the emulator globals sr.c's default connection needs */
+
+#define WINDOW 8
+#define TICKNS 100000L    /* one protocol tick is 0.1 ms */
+#define DEADLINE 60       /* seconds all messages must be delivered in */
+#define SETTLENS 200000000L /* time the engine gets to (not) deliver the stale packets */
+
+struct bench {
+  struct sr_engine *engine;
+  int nconns;
+  long nmsgs;
+  double loss, corrupt;
+  unsigned long seed;
+  atomic_long *delivered;  /* per connection, written by its shard */
+  struct pkt *first;       /* per connection, A's first packet, resent once it is closed */
+  atomic_int *have_first;
+  atomic_long bad;
+};
+
+static _Thread_local unsigned long long rng;
+
+/* xorshift64, one state per shard thread */
+static double uniform(const struct bench *b)
+{
+  if (rng == 0)
+    rng = (b->seed + 1) * 0x9e3779b97f4a7c15ULL ^ (unsigned long long)(sr_engine_self(b->engine) + 1);
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void make_msg(unsigned long conn_id, long seq, char *data)
+{
+  int i;
+
+  data[0] = (char)(seq & 0xff);
+  data[1] = (char)((seq >> 8) & 0xff);
+  data[2] = (char)((seq >> 16) & 0xff);
+  data[3] = (char)((seq >> 24) & 0xff);
+  for (i = 4; i < PAYLOADSIZE; i++)
+    data[i] = (char)(conn_id * 7 + seq + i);
+}
+
+static void bench_tolayer3(void *user, unsigned long conn_id, int AorB, const struct pkt *packet)
+{
+  struct bench *b = user;
+  struct pkt p = *packet;
+
+  if (AorB == A && conn_id < (unsigned long)b->nconns && !atomic_load(&b->have_first[conn_id])) {
+    b->first[conn_id] = p;
+    atomic_store(&b->have_first[conn_id], 1);
+  }
+  if (uniform(b) < b->loss)
+    return;
+  if (uniform(b) < b->corrupt)
+    p.payload[(int)(uniform(b) * PAYLOADSIZE)] ^= 0x5a;
+  /* a full ring loses the packet like the channel would */
+  sr_engine_input(b->engine, sr_engine_self(b->engine), conn_id, 1 - AorB, &p);
+}
+
+static void bench_tolayer5(void *user, unsigned long conn_id, int AorB, char *data)
+{
+  struct bench *b = user;
+  char expect[PAYLOADSIZE];
+  long next;
+
+  if (AorB != B || conn_id >= (unsigned long)b->nconns) {
+    atomic_fetch_add(&b->bad, 1);
+    return;
+  }
+  next = atomic_load_explicit(&b->delivered[conn_id], memory_order_relaxed);
+  make_msg(conn_id, next, expect);
+  if (next >= b->nmsgs || memcmp(expect, data, PAYLOADSIZE) != 0) {
+    atomic_fetch_add(&b->bad, 1);
+    return;
+  }
+  atomic_store_explicit(&b->delivered[conn_id], next + 1, memory_order_release);
+}
+
+static double elapsed(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-N connections] [-n msgs] [-l loss] [-c corrupt] [-S shards] [-s seed]\n"
+         "  -n  messages offered to A on each connection\n"
+         "  -S  worker threads, 0 = one per online CPU\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+  struct bench b;
+  struct sr_engine_config config;
+  struct sr_engine_callbacks callbacks = { bench_tolayer3, bench_tolayer5 };
+  struct timespec start, settle;
+  struct msg message;
+  long *sent;
+  long total, done;
+  double secs;
+  unsigned long id;
+  int i, nshards, stale = 0;
+
+  memset(&b, 0, sizeof(b));
+  b.nconns = 1000;
+  b.nmsgs = 200;
+  b.loss = 0.1;
+  b.corrupt = 0.05;
+  memset(&config, 0, sizeof(config));
+  config.nproducers = 1;
+  config.ringsize = 4096;
+  config.tick_ns = TICKNS;
+  config.conn.windowsize = WINDOW;
+  config.conn.seqspace = 2 * WINDOW;
+  config.conn.backlog = WINDOW;
+
+  for (i = 1; i < argc; i++) {
+    if (i + 1 >= argc || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+      usage(argv[0]);
+      return 2;
+    }
+    switch (argv[i++][1]) {
+    case 'N': b.nconns = atoi(argv[i]); break;
+    case 'n': b.nmsgs = atol(argv[i]); break;
+    case 'l': b.loss = atof(argv[i]); break;
+    case 'c': b.corrupt = atof(argv[i]); break;
+    case 'S': config.nshards = atoi(argv[i]); break;
+    case 's': b.seed = strtoul(argv[i], NULL, 10); break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (b.nconns < 1 || b.nmsgs < 1 || b.nmsgs > 0x7fffffffL) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  b.delivered = calloc(b.nconns, sizeof(atomic_long));
+  b.first = calloc(b.nconns, sizeof(struct pkt));
+  b.have_first = calloc(b.nconns, sizeof(atomic_int));
+  sent = calloc(b.nconns, sizeof(long));
+  if (b.delivered == NULL || b.first == NULL || b.have_first == NULL || sent == NULL) {
+    fprintf(stderr, "sr_engine_bench: out of memory\n");
+    return 2;
+  }
+  b.engine = sr_engine_create(&config, &callbacks, &b);
+  if (b.engine == NULL || sr_engine_start(b.engine) != 0) {
+    fprintf(stderr, "sr_engine_bench: cannot start the engine\n");
+    return 2;
+  }
+  nshards = sr_engine_nshards(b.engine);
+
+  /* never more than a window outstanding, so the backlog always has room */
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  total = (long)b.nconns * b.nmsgs;
+  done = 0;
+  while (done < total && elapsed(&start) < DEADLINE) {
+    done = 0;
+    for (id = 0; id < (unsigned long)b.nconns; id++) {
+      if (sent[id] < b.nmsgs
+          && sent[id] - atomic_load_explicit(&b.delivered[id], memory_order_acquire) < WINDOW) {
+        make_msg(id, sent[id], message.data);
+        if (sr_engine_output(b.engine, 0, id, A, &message) == 0)
+          sent[id]++;
+      }
+      done += atomic_load_explicit(&b.delivered[id], memory_order_acquire);
+    }
+  }
+  secs = elapsed(&start);
+
+  /* closed and never opened connections must stay closed */
+  for (id = 0; id < (unsigned long)b.nconns; id++) {
+    while (sr_engine_close(b.engine, 0, id) != 0)
+      ;
+    if (!atomic_load(&b.have_first[id]))
+      continue;
+    while (sr_engine_input(b.engine, 0, id, B, &b.first[id]) != 0)
+      ;
+    while (sr_engine_input(b.engine, 0, id + b.nconns, B, &b.first[id]) != 0)
+      ;
+    stale++;
+  }
+  settle.tv_sec = 0;
+  settle.tv_nsec = SETTLENS;
+  nanosleep(&settle, NULL);
+  sr_engine_destroy(b.engine);
+
+  printf("%d connections, %d shards, %ld of %ld messages delivered in %.3f s, %.0f messages/s, "
+         "%ld bad, %d stale packets sent\n",
+         b.nconns, nshards,
+         done, total, secs, secs > 0 ? done / secs : 0.0, atomic_load(&b.bad), 2 * stale);
+  free(b.delivered);
+  free(b.first);
+  free(b.have_first);
+  free(sent);
+  return done == total && atomic_load(&b.bad) == 0 ? 0 : 1;
+}
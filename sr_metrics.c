@@ -0,0 +1,194 @@
+#include <stddef.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sr_metrics.h"
+
+/* ******************************************************************
+   JSON and Prometheus export of the per connection counters and
+   histograms sr.c keeps, see sr_metrics.h.
+**********************************************************************/
+
+/* the counters in the order they are written, with their help text */
+struct counter {
+  const char *name;
+  const char *help;
+  size_t offset;
+};
+
+#define COUNTER(field, help) { #field, help, offsetof(struct sr_stats, field) }
+
+static const struct counter counters[] = {
+  COUNTER(packets_sent, "Packets sent for the first time."),
+  COUNTER(packets_resent, "Packets resent after a timeout."),
+  COUNTER(packets_acked, "Packets acknowledged, by their own ACK or a selective one."),
+  COUNTER(total_ACKs_received, "Uncorrupted ACKs received, bare or on data."),
+  COUNTER(new_ACKs, "ACKs that acknowledged at least one packet."),
+  COUNTER(dup_ACKs, "ACKs that acknowledged nothing new."),
+  COUNTER(corrupt_dropped, "Corrupted packets discarded at A or B."),
+  COUNTER(out_of_window, "Uncorrupted data packets discarded outside the receive window."),
+  COUNTER(packets_received, "Uncorrupted data packets received."),
+  COUNTER(delivered, "Messages passed to layer 5."),
+  COUNTER(backlogged, "Messages queued because the window was full."),
+  COUNTER(window_full, "Messages dropped because the window and backlog were full, at A or B."),
+  COUNTER(fec_sent, "Parity packets sent."),
+  COUNTER(fec_recovered, "Lost data packets rebuilt from parity."),
+  COUNTER(rs_sent, "Reed-Solomon repair packets sent on timeouts."),
+  COUNTER(rs_recovered, "Lost data packets decoded from repair packets."),
+  COUNTER(reassembled, "Messages reassembled from fragments.")
+};
+
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]))
+#define PROMBOUNDS 33   /* the Prometheus le bounds, 2^n - 1 for n = 0..32 */
+
+static int counter_value(const struct sr_stats *stats, const struct counter *k)
+{
+  return *(const int *)((const char *)stats + k->offset);
+}
+
+/* the highest value that falls in bucket i, see hist_record() in sr.c */
+static unsigned long bucket_high(int i)
+{
+  int shift = i < 2 * SR_HIST_SUB ? 0 : i / SR_HIST_SUB - 1;
+  unsigned long v = (unsigned long)(i - shift * SR_HIST_SUB);
+
+  return ((v + 1) << shift) - 1;
+}
+
+unsigned long sr_histogram_percentile(const struct sr_histogram *h, double q)
+{
+  unsigned long target, seen = 0;
+  int i;
+
+  if (h->count == 0)
+    return 0;
+  target = (unsigned long)(q * h->count);
+  if (target < q * h->count)
+    target++;
+  if (target == 0)
+    target = 1;
+  for (i = 0; i < SR_HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= target)
+      break;
+  }
+  /* the bucket bound can overshoot the largest value actually seen */
+  if (i >= SR_HIST_BUCKETS || bucket_high(i) > h->max)
+    return h->max;
+  return bucket_high(i);
+}
+
+/* label as the inside of a JSON string */
+static void label_json(FILE *f, const char *label)
+{
+  const unsigned char *p;
+
+  for (p = (const unsigned char *)label; *p != '\0'; p++)
+    if (*p == '"' || *p == '\\')
+      fprintf(f, "\\%c", *p);
+    else if (*p < 0x20)
+      fprintf(f, "\\u%04x", *p);
+    else
+      fputc(*p, f);
+}
+
+/* label as a Prometheus label value, which escapes only these three */
+static void label_prometheus(FILE *f, const char *label)
+{
+  const char *p;
+
+  for (p = label; *p != '\0'; p++)
+    if (*p == '"' || *p == '\\')
+      fprintf(f, "\\%c", *p);
+    else if (*p == '\n')
+      fputs("\\n", f);
+    else
+      fputc(*p, f);
+}
+
+static void histogram_json(FILE *f, const char *name, const struct sr_histogram *h)
+{
+  int i;
+  int first = 1;
+
+  fprintf(f, ", \"%s\": {\"count\": %lu, \"sum\": %.0f, \"mean\": %.3f, \"max\": %lu, "
+          "\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"buckets\": [",
+          name, h->count, h->sum, h->count > 0 ? h->sum / h->count : 0.0, h->max,
+          sr_histogram_percentile(h, 0.50), sr_histogram_percentile(h, 0.90),
+          sr_histogram_percentile(h, 0.99), sr_histogram_percentile(h, 0.999));
+  for (i = 0; i < SR_HIST_BUCKETS; i++) {
+    if (h->buckets[i] == 0)
+      continue;
+    fprintf(f, "%s[%lu, %lu]", first ? "" : ", ", bucket_high(i), h->buckets[i]);
+    first = 0;
+  }
+  fprintf(f, "]}");
+}
+
+void sr_metrics_json(FILE *f, const char *label, const struct sr_stats *stats,
+                     const struct sr_histograms *hist)
+{
+  size_t k;
+
+  fputs("{\"conn\": \"", f);
+  label_json(f, label);
+  fputc('"', f);
+  for (k = 0; k < NCOUNTERS; k++)
+    fprintf(f, ", \"%s\": %d", counters[k].name, counter_value(stats, &counters[k]));
+  histogram_json(f, "ack_latency", &hist->ack_latency);
+  histogram_json(f, "window", &hist->window);
+  fprintf(f, "}\n");
+}
+
+/* writes sr_<name>{conn="<label>", the caller adds any other labels */
+static void series(FILE *f, const char *name, const char *label)
+{
+  fprintf(f, "sr_%s{conn=\"", name);
+  label_prometheus(f, label);
+  fputc('"', f);
+}
+
+/* every 2^n - 1 is the highest value of some bucket, so the counts are exact */
+static void histogram_prometheus(FILE *f, const char *label, const char *name, const char *help,
+                                 const struct sr_histogram *h)
+{
+  char bucket[64], sum[64], count[64];
+  unsigned long bound, cumulative = 0;
+  int i = 0, n;
+
+  snprintf(bucket, sizeof(bucket), "%s_bucket", name);
+  snprintf(sum, sizeof(sum), "%s_sum", name);
+  snprintf(count, sizeof(count), "%s_count", name);
+  fprintf(f, "# HELP sr_%s %s\n# TYPE sr_%s histogram\n", name, help, name);
+  for (n = 0; n < PROMBOUNDS; n++) {
+    bound = (1UL << n) - 1;
+    for (; i < SR_HIST_BUCKETS && bucket_high(i) <= bound; i++)
+      cumulative += h->buckets[i];
+    series(f, bucket, label);
+    fprintf(f, ",le=\"%lu\"} %lu\n", bound, cumulative);
+  }
+  series(f, bucket, label);
+  fprintf(f, ",le=\"+Inf\"} %lu\n", h->count);
+  series(f, sum, label);
+  fprintf(f, "} %.0f\n", h->sum);
+  series(f, count, label);
+  fprintf(f, "} %lu\n", h->count);
+}
+
+void sr_metrics_prometheus(FILE *f, const char *label, const struct sr_stats *stats,
+                           const struct sr_histograms *hist)
+{
+  size_t k;
+
+  for (k = 0; k < NCOUNTERS; k++) {
+    fprintf(f, "# HELP sr_%s_total %s\n# TYPE sr_%s_total counter\n",
+            counters[k].name, counters[k].help, counters[k].name);
+    fprintf(f, "sr_%s_total{conn=\"", counters[k].name);
+    label_prometheus(f, label);
+    fprintf(f, "\"} %d\n", counter_value(stats, &counters[k]));
+  }
+  histogram_prometheus(f, label, "ack_latency_ticks",
+                       "Ticks from a packet's first send to its acknowledgement.", &hist->ack_latency);
+  histogram_prometheus(f, label, "window_packets",
+                       "Packets outstanding at the sender, sampled on every send.", &hist->window);
+}
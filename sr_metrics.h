@@ -0,0 +1,23 @@
+/* Exports a connection's struct sr_stats and struct sr_histograms for
+   monitoring and capacity planning.  Include after stdio.h, emulator.h
+   and sr.h.
+
+   label names the connection in the output, in JSON as "conn" and in
+   Prometheus text as the conn label, so several connections can be
+   written to one stream.  It may hold any characters, quotes, backslashes
+   and newlines are escaped. */
+
+/* the value at or below which the fraction q of the recorded values lie,
+   as the highest value of its bucket, 0 when nothing was recorded */
+extern unsigned long sr_histogram_percentile(const struct sr_histogram *h, double q);
+
+/* one JSON object on one line */
+extern void sr_metrics_json(FILE *f, const char *label, const struct sr_stats *stats,
+                            const struct sr_histograms *hist);
+
+/* Prometheus text exposition format, counters and histograms.  Every
+   histogram has the same buckets, le 0, 1, 3, 7 and so on up to 2^32 - 1,
+   whatever was recorded, so rate() and histogram_quantile() work across
+   scrapes. */
+extern void sr_metrics_prometheus(FILE *f, const char *label, const struct sr_stats *stats,
+                                  const struct sr_histograms *hist);
@@ -0,0 +1,512 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "emulator.h"
+#include "sr.h"
+
+/* ******************************************************************
+   CPU cost of the protocol code itself.
+
+   Calls sr_A_output(), sr_A_output_batch(), sr_A_input(), sr_B_input(),
+   sr_B_input_batch() and sr_A_timerinterrupt(), the code behind
+   A_output() and friends, on connections whose lower layer only records
+   the packets, and reports nanoseconds, instructions (user mode, from
+   perf_event_open) and heap allocations per call.  Each scenario runs in
+   batches of one window; only the calls being measured are inside the
+   timed region, and the cost of timing an empty region is subtracted.
+
+   The sequence space defaults to twice the window, so every scenario
+   wraps its sequence numbers every other batch.
+
+   Build on Linux with the allocation counters wrapped in:
+     gcc -O2 -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o sr_microbench \
+         sr_microbench.c sr_sim.c sim.c sr.c checksum.c erasure.c sr_trace.c -pthread -lm
+**********************************************************************/
+
+/* sr_sim.c provides the emulator globals sr.c's default connection needs */
+
+#define DEFAULTOPS 2000000L   /* calls measured per scenario */
+#define TIMEOUT 64            /* initial timeout of the timer scenarios, in ticks */
+
+
+/********* allocation counting, see the build line ************/
+
+static long allocations;
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t n, size_t size);
+extern void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+  allocations++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+  allocations++;
+  return __real_realloc(p, size);
+}
+
+
+/********* measuring ************/
+
+static int perf_fd = -1;
+
+struct sample {
+  double ns;
+  long long instructions;
+  long allocations;
+};
+
+struct totals {
+  double ns;
+  double instructions;
+  double allocations;
+  long ops;
+};
+
+static struct sample overhead;   /* what timing an empty region costs */
+
+static long long read_instructions(void)
+{
+  long long count = 0;
+
+  if (perf_fd >= 0 && read(perf_fd, &count, sizeof(count)) != sizeof(count))
+    count = 0;
+  return count;
+}
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void open_counter(void)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void start(struct sample *s)
+{
+  s->allocations = allocations;
+  s->instructions = read_instructions();
+  s->ns = now_ns();
+}
+
+static void stop(const struct sample *s, struct totals *t, long ops)
+{
+  double ns = now_ns();
+  long long instructions = read_instructions();
+
+  t->ns += ns - s->ns - overhead.ns;
+  t->instructions += (double)(instructions - s->instructions - overhead.instructions);
+  t->allocations += (double)(allocations - s->allocations);
+  t->ops += ops;
+}
+
+static void calibrate(void)
+{
+  struct sample s;
+  struct totals t;
+  int i;
+
+  memset(&t, 0, sizeof(t));
+  for (i = 0; i < 10000; i++) {
+    start(&s);
+    stop(&s, &t, 1);
+  }
+  overhead.ns = t.ns / t.ops;
+  overhead.instructions = (long long)(t.instructions / t.ops);
+}
+
+static void report(const char *name, const struct totals *t)
+{
+  printf("%-44s %9.1f", name, t->ns / t->ops);
+  if (perf_fd >= 0)
+    printf(" %12.1f", t->instructions / t->ops);
+  else
+    printf(" %12s", "-");
+  printf(" %10.3f\n", t->allocations / t->ops);
+}
+
+
+/********* connections with a recording lower layer ************/
+
+/* the packets one connection passed to layer 3 since the last reset */
+struct endpoint {
+  struct sr_conn *conn;
+  struct pkt *out;
+  int nout;
+};
+
+static void bench_tolayer3(void *user, int AorB, const struct pkt *packet)
+{
+  struct endpoint *e = user;
+
+  (void)AorB;
+  e->out[e->nout++] = *packet;
+}
+
+static void bench_tolayer3_batch(void *user, int AorB, const struct pkt *const *packets, int n)
+{
+  struct endpoint *e = user;
+  int i;
+
+  (void)AorB;
+  for (i = 0; i < n; i++)
+    e->out[e->nout++] = *packets[i];
+}
+
+static void bench_tolayer5(void *user, int AorB, char *data)
+{
+  (void)user;
+  (void)AorB;
+  (void)data;
+}
+
+static void bench_tolayer5_batch(void *user, int AorB, char *const *data, int n)
+{
+  (void)user;
+  (void)AorB;
+  (void)data;
+  (void)n;
+}
+
+static void bench_starttimer(void *user, int AorB, float increment)
+{
+  (void)user;
+  (void)AorB;
+  (void)increment;
+}
+
+static void bench_stoptimer(void *user, int AorB)
+{
+  (void)user;
+  (void)AorB;
+}
+
+/* the fake clock, moved by hand to where a timer should go off */
+static double bench_time;
+
+static double bench_now(void *user)
+{
+  (void)user;
+  return bench_time;
+}
+
+static const struct sr_ops bench_ops = {
+  bench_tolayer3, bench_tolayer5, bench_starttimer, bench_stoptimer, bench_now, NULL,
+  bench_tolayer3_batch, NULL
+};
+
+/* B_input_batch's receiver, delivering each in-order run in one call;
+   bench_ops keeps B_input's one tolayer5 per message */
+static const struct sr_ops batch_ops = {
+  bench_tolayer3, bench_tolayer5, bench_starttimer, bench_stoptimer, bench_now, NULL,
+  bench_tolayer3_batch, bench_tolayer5_batch
+};
+
+static struct sr_config config;
+static long nops = DEFAULTOPS;
+static struct msg message;
+static struct msg *messages;   /* a window of them for A_output_batch */
+static struct endpoint a, b;   /* the sender and the receiver */
+static struct pkt *data;       /* a window of A's packets */
+static struct pkt *acks;       /* B's ACKs for them */
+
+static int open_endpoint(struct endpoint *e, const struct sr_ops *ops)
+{
+  sr_conn_destroy(e->conn);
+  e->conn = sr_conn_create(&config, ops, e);
+  e->nout = 0;
+  return e->conn != NULL ? 0 : -1;
+}
+
+/* A sends a window, untimed, and data[] gets the packets */
+static void send_window(void)
+{
+  int i;
+
+  a.nout = 0;
+  for (i = 0; i < config.windowsize; i++)
+    sr_A_output(a.conn, message);
+  memcpy(data, a.out, config.windowsize * sizeof(struct pkt));
+}
+
+/* B receives data[] in the given order, untimed, and acks[] gets the ACKs */
+static void receive_window(const int *order)
+{
+  int i;
+
+  b.nout = 0;
+  for (i = 0; i < config.windowsize; i++)
+    sr_B_input(b.conn, data[order[i]]);
+  memcpy(acks, b.out, config.windowsize * sizeof(struct pkt));
+}
+
+static void ack_window(void)
+{
+  int i;
+
+  for (i = 0; i < config.windowsize; i++)
+    sr_A_input(a.conn, acks[i]);
+}
+
+
+/********* scenarios ************/
+
+static int *inorder, *reversed, *firstlost;
+
+static void bench_A_output(const char *name)
+{
+  struct sample s;
+  struct totals t;
+  int i;
+
+  memset(&t, 0, sizeof(t));
+  while (t.ops < nops) {
+    a.nout = 0;
+    start(&s);
+    for (i = 0; i < config.windowsize; i++)
+      sr_A_output(a.conn, message);
+    stop(&s, &t, config.windowsize);
+    memcpy(data, a.out, config.windowsize * sizeof(struct pkt));
+    receive_window(inorder);
+    ack_window();
+  }
+  report(name, &t);
+}
+
+static void bench_A_output_batch(const char *name)
+{
+  struct sample s;
+  struct totals t;
+
+  memset(&t, 0, sizeof(t));
+  while (t.ops < nops) {
+    a.nout = 0;
+    start(&s);
+    sr_A_output_batch(a.conn, messages, config.windowsize);
+    stop(&s, &t, config.windowsize);
+    memcpy(data, a.out, config.windowsize * sizeof(struct pkt));
+    receive_window(inorder);
+    ack_window();
+  }
+  report(name, &t);
+}
+
+static void bench_A_output_full(const char *name)
+{
+  struct sample s;
+  struct totals t;
+  int i;
+
+  memset(&t, 0, sizeof(t));
+  send_window();
+  while (t.ops < nops) {
+    start(&s);
+    for (i = 0; i < config.windowsize; i++)
+      sr_A_output(a.conn, message);
+    stop(&s, &t, config.windowsize);
+  }
+  receive_window(inorder);
+  ack_window();
+  report(name, &t);
+}
+
+static void bench_A_input(const char *name, const int *order)
+{
+  struct sample s;
+  struct totals t;
+  int i;
+
+  memset(&t, 0, sizeof(t));
+  while (t.ops < nops) {
+    send_window();
+    receive_window(order);
+    start(&s);
+    for (i = 0; i < config.windowsize; i++)
+      sr_A_input(a.conn, acks[i]);
+    stop(&s, &t, config.windowsize);
+  }
+  report(name, &t);
+}
+
+static void bench_B_input(const char *name, const int *order)
+{
+  struct sample s;
+  struct totals t;
+  int i;
+
+  memset(&t, 0, sizeof(t));
+  while (t.ops < nops) {
+    send_window();
+    b.nout = 0;
+    start(&s);
+    for (i = 0; i < config.windowsize; i++)
+      sr_B_input(b.conn, data[order[i]]);
+    stop(&s, &t, config.windowsize);
+    memcpy(acks, b.out, config.windowsize * sizeof(struct pkt));
+    ack_window();
+  }
+  report(name, &t);
+}
+
+/* on a fresh pair of endpoints, B's with batch_ops */
+static int bench_B_input_batch(const char *name)
+{
+  struct sample s;
+  struct totals t;
+  int i;
+
+  if (open_endpoint(&a, &bench_ops) != 0 || open_endpoint(&b, &batch_ops) != 0)
+    return -1;
+  memset(&t, 0, sizeof(t));
+  while (t.ops < nops) {
+    send_window();
+    b.nout = 0;
+    start(&s);
+    sr_B_input_batch(b.conn, data, config.windowsize);
+    stop(&s, &t, config.windowsize);
+    /* one ACK for the whole window */
+    for (i = 0; i < b.nout; i++)
+      sr_A_input(a.conn, b.out[i]);
+  }
+  report(name, &t);
+  return open_endpoint(&a, &bench_ops) != 0 || open_endpoint(&b, &bench_ops) != 0 ? -1 : 0;
+}
+
+/* the one interrupt where the whole window times out.
+   The sender is new every batch so ACKs never shorten its timeout. */
+static int bench_timer(const char *name)
+{
+  struct sample s;
+  struct totals t;
+
+  memset(&t, 0, sizeof(t));
+  while (t.ops < nops / config.windowsize) {
+    bench_time = 0.0;
+    if (open_endpoint(&a, &bench_ops) != 0)
+      return -1;
+    send_window();
+    /* the timer is armed for the window's deadline, so it goes off once */
+    bench_time = TIMEOUT;
+    start(&s);
+    sr_A_timerinterrupt(a.conn);
+    stop(&s, &t, 1);
+  }
+  bench_time = 0.0;
+  report(name, &t);
+  return open_endpoint(&a, &bench_ops) != 0 || open_endpoint(&b, &bench_ops) != 0 ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-w window] [-q seqspace] [-c] [-n calls]\n"
+         "  -q  sequence space, default twice the window, 0 = the largest, 2^31\n"
+         "  -c  CRC32C checksums instead of the additive sum\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+  long seqspace = -1;
+  int i, w;
+
+  memset(&config, 0, sizeof(config));
+  config.windowsize = 64;
+  config.timeout = TIMEOUT;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      config.checksum = SR_CHECKSUM_CRC32C;
+      continue;
+    }
+    if (i + 1 >= argc || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+      usage(argv[0]);
+      return 2;
+    }
+    switch (argv[i++][1]) {
+    case 'w': config.windowsize = atoi(argv[i]); break;
+    case 'q': seqspace = atol(argv[i]); break;
+    case 'n': nops = atol(argv[i]); break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  config.seqspace = seqspace < 0 ? 2 * (unsigned int)config.windowsize : (unsigned int)seqspace;
+  w = config.windowsize;
+  if (w < 2 || nops < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  /* everything both endpoints can send in a window, with room for duplicates */
+  a.out = calloc(4 * w, sizeof(struct pkt));
+  b.out = calloc(4 * w, sizeof(struct pkt));
+  data = calloc(w, sizeof(struct pkt));
+  acks = calloc(w, sizeof(struct pkt));
+  inorder = calloc(w, sizeof(int));
+  reversed = calloc(w, sizeof(int));
+  firstlost = calloc(w, sizeof(int));
+  messages = calloc(w, sizeof(struct msg));
+  if (!a.out || !b.out || !data || !acks || !inorder || !reversed || !firstlost || !messages
+      || open_endpoint(&a, &bench_ops) != 0 || open_endpoint(&b, &bench_ops) != 0) {
+    printf("sr_microbench: cannot set up window %d sequence space %u\n", w, config.seqspace);
+    return 1;
+  }
+  for (i = 0; i < w; i++) {
+    inorder[i] = i;
+    reversed[i] = w - 1 - i;
+    firstlost[i] = (i + 1) % w;   /* packet 0 arrives last, as if resent */
+  }
+  memset(message.data, 'a', sizeof(message.data));
+  for (i = 0; i < w; i++)
+    messages[i] = message;
+
+  open_counter();
+  calibrate();
+  printf("window %d, sequence space %u, %s checksum, %ld calls per scenario\n",
+         w, config.seqspace, config.checksum == SR_CHECKSUM_CRC32C ? "CRC32C" : "additive", nops);
+  printf("%-44s %9s %12s %10s\n", "scenario", "ns/op", "instr/op", "allocs/op");
+
+  bench_A_output("A_output, window has room");
+  bench_A_output_batch("A_output_batch, window has room, per msg");
+  bench_A_output_full("A_output, window full");
+  bench_A_input("A_input, ACKs in order", inorder);
+  bench_A_input("A_input, first packet lost (SACK + slide)", firstlost);
+  bench_B_input("B_input, in order", inorder);
+  bench_B_input("B_input, window arrives in reverse", reversed);
+  if (bench_B_input_batch("B_input_batch, window in order, per pkt") != 0
+      || bench_timer("A_timerinterrupt, whole window due") != 0) {
+    printf("sr_microbench: out of memory\n");
+    return 1;
+  }
+
+  sr_conn_destroy(a.conn);
+  sr_conn_destroy(b.conn);
+  return 0;
+}
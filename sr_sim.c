@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sim.h"
+#include "sr_sim.h"
+
+/* ******************************************************************
+   One struct sr_conn driven by one struct sim.  The run shares no state
+   with any other, so runs can go on in parallel threads.
+**********************************************************************/
+
+/* sr.c's default connection reports into these and calls the functions
+   below, runs through sr_sim_run() never use it */
+int TRACE = 0;
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+void tolayer3(int AorB, struct pkt packet) { (void)AorB; (void)packet; }
+void tolayer5(int AorB, char datasent[PAYLOADSIZE]) { (void)AorB; (void)datasent; }
+void starttimer(int AorB, float increment) { (void)AorB; (void)increment; }
+void stoptimer(int AorB) { (void)AorB; }
+double currenttime(void) { return 0.0; }
+
+struct run {
+  struct sim *sim;
+  struct sr_conn *conn;
+};
+
+static void run_tolayer3(void *user, int AorB, const struct pkt *packet)
+{
+  sim_tolayer3(((struct run *)user)->sim, AorB, packet);
+}
+
+static void run_tolayer5(void *user, int AorB, char *data)
+{
+  sim_tolayer5(((struct run *)user)->sim, AorB, data);
+}
+
+static void run_starttimer(void *user, int AorB, float increment)
+{
+  sim_starttimer(((struct run *)user)->sim, AorB, increment);
+}
+
+static void run_stoptimer(void *user, int AorB)
+{
+  sim_stoptimer(((struct run *)user)->sim, AorB);
+}
+
+static double run_now(void *user)
+{
+  return sim_time(((struct run *)user)->sim);
+}
+
+static const struct sr_ops run_ops = {
+  run_tolayer3, run_tolayer5, run_starttimer, run_stoptimer, run_now, NULL, NULL, NULL
+};
+
+/* a message was refused when the connection counted it in window_full */
+static int run_output(void *proto, int AorB, struct msg message)
+{
+  struct sr_conn *conn = ((struct run *)proto)->conn;
+  int full = sr_conn_stats(conn)->window_full;
+
+  if (AorB == A)
+    sr_A_output(conn, message);
+  else
+    sr_B_output(conn, message);
+  return sr_conn_stats(conn)->window_full == full ? 0 : -1;
+}
+
+static void run_input(void *proto, int AorB, struct pkt packet)
+{
+  if (AorB == A)
+    sr_A_input(((struct run *)proto)->conn, packet);
+  else
+    sr_B_input(((struct run *)proto)->conn, packet);
+}
+
+static void run_timerinterrupt(void *proto, int AorB)
+{
+  if (AorB == A)
+    sr_A_timerinterrupt(((struct run *)proto)->conn);
+  else
+    sr_B_timerinterrupt(((struct run *)proto)->conn);
+}
+
+static const struct sim_protocol run_protocol = {
+  run_output, run_input, run_timerinterrupt
+};
+
+int sr_sim_run(const struct sim_params *params, const struct sr_config *config,
+               struct sr_sim_result *result)
+{
+  struct run run;
+  int ret = -1;
+
+  memset(result, 0, sizeof(*result));
+  run.conn = sr_conn_create(config, &run_ops, &run);
+  run.sim = sim_create(params, &run_protocol, &run);
+  if (run.conn != NULL && run.sim != NULL) {
+    result->ok = sim_run(run.sim) == 0;
+    result->sim = *sim_stats(run.sim);
+    result->conn = *sr_conn_stats(run.conn);
+    result->p50 = sim_latency_percentile(run.sim, 0.50);
+    result->p90 = sim_latency_percentile(run.sim, 0.90);
+    result->p99 = sim_latency_percentile(run.sim, 0.99);
+    result->p999 = sim_latency_percentile(run.sim, 0.999);
+    ret = 0;
+  }
+  sim_destroy(run.sim);
+  sr_conn_destroy(run.conn);
+  return ret;
+}
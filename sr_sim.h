@@ -0,0 +1,16 @@
+/* Runs one SR connection over one emulated channel, for the sweep and
+   benchmark drivers.  Include after emulator.h, sr.h and sim.h.
+
+   sr_sim.c also defines the emulator globals and functions sr.c's default
+   connection refers to, so link it instead of emulator.c, never with it. */
+
+struct sr_sim_result {
+  int ok;                  /* every accepted message arrived intact, once and in order */
+  struct sim_stats sim;
+  struct sr_stats conn;
+  double p50, p90, p99, p999;   /* message latency percentiles */
+};
+
+/* 0 when the run completed, whatever its outcome, -1 when it could not be set up */
+extern int sr_sim_run(const struct sim_params *params, const struct sr_config *config,
+                      struct sr_sim_result *result);
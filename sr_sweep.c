@@ -0,0 +1,243 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sim.h"
+#include "sr_sim.h"
+
+/* ******************************************************************
+   Parameter sweep over the SR protocol.
+
+   Runs one simulation for every combination of the loss, corruption,
+   window and initial timeout values given, each repeated with -r
+   different seeds, spread over all CPUs.  Every run has its own
+   struct sr_conn and struct sim, so the runs share nothing, and a run
+   gives the same numbers whatever thread it lands on.  Prints one CSV
+   row per run, in grid order, with diagnostics on stderr.  Exits 1 if
+   any run lost, duplicated or reordered a message, and 2 if any run
+   could not start (its row has error 1), for example a window that
+   does not fit the sequence space.
+
+   Build and run, for example
+     gcc -O2 -pthread -o sr_sweep sr_sweep.c sr_sim.c sim.c sr.c checksum.c erasure.c sr_trace.c -lm
+     ./sr_sweep -l 0,0.1,0.2 -c 0,0.1 -w 6,16,64 -o 0,12,24 -r 4 > sweep.csv
+**********************************************************************/
+
+#define MAXVALUES 64   /* values per axis */
+
+struct axis {
+  double values[MAXVALUES];
+  int n;
+};
+
+/* one simulation of the sweep */
+struct job {
+  double loss, corrupt;
+  int window, timeout;
+  int replicate;
+  unsigned long seed;
+  int error;                   /* 1 = the run could not start, see stderr */
+};
+
+/* the sweep settings shared by every job */
+static struct sim_params base;
+static struct sr_config baseconfig;
+static int fullseqspace;       /* 1 = the largest sequence space, 0 = twice the window */
+
+static struct job *jobs;
+static struct sr_sim_result *results;
+static long njobs;
+static long nextjob;
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/********* running the jobs ************/
+
+static void run_job(struct job *job, struct sr_sim_result *result)
+{
+  struct sim_params params = base;
+  struct sr_config config = baseconfig;
+
+  params.lossprob = job->loss;
+  params.corruptprob = job->corrupt;
+  params.seed = job->seed;
+  config.windowsize = job->window;
+  config.seqspace = fullseqspace ? 0 : 2 * (unsigned int)job->window;
+  config.timeout = job->timeout;
+  job->error = sr_sim_run(&params, &config, result) != 0;
+}
+
+static void *worker(void *arg)
+{
+  long i;
+
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&joblock);
+    i = nextjob++;
+    pthread_mutex_unlock(&joblock);
+    if (i >= njobs)
+      return NULL;
+    run_job(&jobs[i], &results[i]);
+  }
+}
+
+
+/********* the grid ************/
+
+/* seeds for the runs, mixed so neighbouring jobs get unrelated random streams */
+static unsigned long job_seed(unsigned long seed, long job)
+{
+  unsigned long z = seed + (unsigned long)job * 0x9e3779b9UL;
+
+  z = (z ^ (z >> 16)) * 0x45d9f3bUL;
+  z = (z ^ (z >> 16)) * 0x45d9f3bUL;
+  return z ^ (z >> 16);
+}
+
+static int parse_axis(const char *arg, struct axis *axis)
+{
+  char *end;
+
+  axis->n = 0;
+  for (;;) {
+    if (axis->n == MAXVALUES)
+      return -1;
+    axis->values[axis->n++] = strtod(arg, &end);
+    if (end == arg)
+      return -1;
+    if (*end == '\0')
+      return 0;
+    if (*end != ',')
+      return -1;
+    arg = end + 1;
+  }
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-l losses] [-c corruptions] [-w windows] [-o timeouts] [-r replicates]\n"
+         "          [-n msgs] [-t interval] [-f] [-q] [-j threads] [-s seed]\n"
+         "  lists are comma separated, -o 0 is the default initial timeout,\n"
+         "  -f packets do not queue behind each other, -q use the largest\n"
+         "  sequence space, 2^31, instead of twice the window\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+  struct axis loss, corrupt, window, timeout;
+  pthread_t *threads;
+  int nthreads = 0, replicates = 1;
+  unsigned long seed = 1;
+  int li, ci, wi, oi, r, i;
+  long j;
+  struct sr_sim_result *res;
+  int failed = 0;
+
+  sim_default_params(&base);
+  base.nmsgs = 10000;
+  memset(&baseconfig, 0, sizeof(baseconfig));
+  parse_axis("0.1", &loss);
+  parse_axis("0.1", &corrupt);
+  parse_axis("6", &window);
+  parse_axis("0", &timeout);
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0) {
+      base.serialise = 0;
+      continue;
+    }
+    if (strcmp(argv[i], "-q") == 0) {
+      fullseqspace = 1;
+      continue;
+    }
+    if (i + 1 >= argc || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+      usage(argv[0]);
+      return 2;
+    }
+    switch (argv[i++][1]) {
+    case 'l': failed = parse_axis(argv[i], &loss); break;
+    case 'c': failed = parse_axis(argv[i], &corrupt); break;
+    case 'w': failed = parse_axis(argv[i], &window); break;
+    case 'o': failed = parse_axis(argv[i], &timeout); break;
+    case 'r': replicates = atoi(argv[i]); break;
+    case 'n': base.nmsgs = atol(argv[i]); break;
+    case 't': base.msginterval = atof(argv[i]); break;
+    case 'j': nthreads = atoi(argv[i]); break;
+    case 's': seed = strtoul(argv[i], NULL, 10); break;
+    default: failed = -1; break;
+    }
+    if (failed) {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (replicates < 1 || base.msginterval <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (nthreads <= 0)
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads <= 0)
+    nthreads = 1;
+
+  njobs = (long)loss.n * corrupt.n * window.n * timeout.n * replicates;
+  jobs = calloc(njobs, sizeof(struct job));
+  results = calloc(njobs, sizeof(struct sr_sim_result));
+  threads = calloc(nthreads, sizeof(pthread_t));
+  if (jobs == NULL || results == NULL || threads == NULL) {
+    fprintf(stderr, "sr_sweep: out of memory\n");
+    return 1;
+  }
+  j = 0;
+  for (li = 0; li < loss.n; li++)
+    for (ci = 0; ci < corrupt.n; ci++)
+      for (wi = 0; wi < window.n; wi++)
+        for (oi = 0; oi < timeout.n; oi++)
+          for (r = 0; r < replicates; r++, j++) {
+            jobs[j].loss = loss.values[li];
+            jobs[j].corrupt = corrupt.values[ci];
+            jobs[j].window = (int)window.values[wi];
+            jobs[j].timeout = (int)timeout.values[oi];
+            jobs[j].replicate = r;
+            jobs[j].seed = job_seed(seed, j);
+          }
+
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+      nthreads = i;
+      break;
+    }
+  /* without any thread the jobs run here */
+  if (nthreads == 0)
+    worker(NULL);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  printf("loss,corrupt,window,timeout,replicate,seed,error,ok,generated,dropped,delivered,time,"
+         "goodput,sent,resent,latency_mean,latency_p50,latency_p90,latency_p99,latency_max\n");
+  for (j = 0; j < njobs; j++) {
+    res = &results[j];
+    printf("%g,%g,%d,%d,%d,%lu,%d,%d,%ld,%ld,%ld,%.3f,%.6f,%ld,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+           jobs[j].loss, jobs[j].corrupt, jobs[j].window, jobs[j].timeout, jobs[j].replicate,
+           jobs[j].seed, jobs[j].error, res->ok, res->sim.generated, res->sim.dropped, res->sim.delivered,
+           res->sim.endtime, res->sim.endtime > 0 ? res->sim.delivered / res->sim.endtime : 0.0,
+           res->sim.sent, res->conn.packets_resent,
+           res->sim.delivered > 0 ? res->sim.latency_sum / res->sim.delivered : 0.0,
+           res->p50, res->p90, res->p99, res->sim.latency_max);
+    if (jobs[j].error) {
+      fprintf(stderr, "sr_sweep: cannot run window %d timeout %d\n", jobs[j].window, jobs[j].timeout);
+      failed = 2;
+    } else if (!res->ok && failed == 0)
+      failed = 1;
+  }
+
+  free(threads);
+  free(results);
+  free(jobs);
+  return failed;
+}
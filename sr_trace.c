@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sr_trace.h"
+
+/* ******************************************************************
+   Binary event tracer.
+
+   A thread's ring is created on its first event and then only that
+   thread writes it: the event goes into the slot at head and head is
+   published with a release store, so sr_trace_write() reading with an
+   acquire load sees whole events.  Rings stay registered after their
+   thread exits so its last events can still be written out.
+**********************************************************************/
+
+#define MAGIC "SRTRACE1"
+
+struct ring {
+  struct ring *next;            /* all rings, newest first */
+  uint32_t thread;              /* order the threads first recorded in */
+  uint32_t mask;                /* events - 1, a power of two minus one */
+  _Atomic uint64_t head;        /* events recorded so far */
+  struct sr_trace_event events[];
+};
+
+_Atomic int sr_trace_enabled;
+
+static struct ring *rings;
+static uint32_t nrings;
+static uint32_t ringsize;       /* events per ring */
+static pthread_mutex_t ringlock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local struct ring *mine;
+static atomic_uint_least32_t nextconn;
+
+/* the calling thread's ring, registered on first use */
+static struct ring *attach(void)
+{
+  struct ring *r;
+  uint32_t size;
+
+  pthread_mutex_lock(&ringlock);
+  size = ringsize;
+  pthread_mutex_unlock(&ringlock);
+  if (size == 0)
+    return NULL;
+  r = calloc(1, sizeof(struct ring) + size * sizeof(struct sr_trace_event));
+  if (r == NULL)
+    return NULL;
+  r->mask = size - 1;
+  atomic_init(&r->head, 0);
+  pthread_mutex_lock(&ringlock);
+  r->thread = nrings++;
+  r->next = rings;
+  rings = r;
+  pthread_mutex_unlock(&ringlock);
+  mine = r;
+  return r;
+}
+
+void sr_trace_record(uint32_t conn, int type, int side, uint32_t seq, uint32_t tick, int aux)
+{
+  struct ring *r = mine;
+  struct sr_trace_event *e;
+  uint64_t head;
+
+  if (r == NULL && (r = attach()) == NULL)
+    return;
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  e = &r->events[head & r->mask];
+  e->tick = tick;
+  e->seq = seq;
+  e->conn = conn;
+  e->aux = (uint16_t)(aux < 0 ? 0 : aux > 0xffff ? 0xffff : aux);
+  e->type = (uint8_t)type;
+  e->side = (uint8_t)side;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+uint32_t sr_trace_conn_id(void)
+{
+  return atomic_fetch_add_explicit(&nextconn, 1, memory_order_relaxed) + 1;
+}
+
+int sr_trace_start(unsigned int events_per_thread)
+{
+  uint32_t size = 1;
+
+  if (events_per_thread == 0)
+    return -1;
+  while (size < events_per_thread)
+    size *= 2;
+  /* rings already created keep their size */
+  pthread_mutex_lock(&ringlock);
+  if (ringsize == 0)
+    ringsize = size;
+  pthread_mutex_unlock(&ringlock);
+  atomic_store_explicit(&sr_trace_enabled, 1, memory_order_relaxed);
+  return 0;
+}
+
+void sr_trace_stop(void)
+{
+  atomic_store_explicit(&sr_trace_enabled, 0, memory_order_relaxed);
+}
+
+int sr_trace_write(const char *path)
+{
+  FILE *f;
+  struct ring *r;
+  uint64_t head, first, i;
+  uint32_t count;
+  int ok;
+
+  f = fopen(path, "wb");
+  if (f == NULL)
+    return -1;
+  pthread_mutex_lock(&ringlock);
+  ok = fwrite(MAGIC, 1, 8, f) == 8 && fwrite(&nrings, sizeof(nrings), 1, f) == 1;
+  for (r = rings; r != NULL && ok; r = r->next) {
+    head = atomic_load_explicit(&r->head, memory_order_acquire);
+    first = head > (uint64_t)r->mask + 1 ? head - r->mask - 1 : 0;
+    count = (uint32_t)(head - first);
+    ok = fwrite(&r->thread, sizeof(r->thread), 1, f) == 1 && fwrite(&count, sizeof(count), 1, f) == 1;
+    for (i = first; i < head && ok; i++)
+      ok = fwrite(&r->events[i & r->mask], sizeof(struct sr_trace_event), 1, f) == 1;
+  }
+  pthread_mutex_unlock(&ringlock);
+  if (fclose(f) != 0)
+    ok = 0;
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,58 @@
+/* Binary event tracer for sr.c, see sr_trace.c.
+
+   Every thread records into its own ring of fixed size events, oldest
+   overwritten first, so recording takes no locks and costs a few stores.
+   sr_trace_write() saves the rings and sr_trace_decode turns them back into
+   the messages TRACE prints. */
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* event types, side is A or B */
+#define SR_EV_SEND       1   /* seq sent for the first time */
+#define SR_EV_RESEND     2   /* seq resent after a timeout */
+#define SR_EV_QUEUED     3   /* window full, message queued in the backlog */
+#define SR_EV_WINDOWFULL 4   /* window and backlog full, message dropped */
+#define SR_EV_ACK        5   /* ACK seq acknowledged something new */
+#define SR_EV_DUPACK     6   /* ACK seq acknowledged nothing new */
+#define SR_EV_CORRUPT    7   /* a corrupted packet arrived */
+#define SR_EV_RECEIVE    8   /* seq arrived outside the receive window */
+#define SR_EV_BUFFER     9   /* seq arrived and was buffered */
+#define SR_EV_DUP        10  /* seq arrived again while still buffered */
+#define SR_EV_DELIVER    11  /* seq passed up to layer 5 */
+#define SR_EV_ACKSENT    12  /* ACK seq sent */
+#define SR_EV_TIMER      13  /* the delayed ACK timer expired, ACK seq sent */
+#define SR_EV_RTT        14  /* round trip sample aux, timeout now seq */
+#define SR_EV_PARITY     15  /* parity for the aux packets from seq sent */
+#define SR_EV_REPAIR     16  /* seq rebuilt from parity */
+#define SR_EV_RSREPAIR   17  /* repair aux >> 8 over the aux & 255 packets from seq sent */
+#define SR_EV_RSDECODE   18  /* seq decoded from repair packets */
+
+struct sr_trace_event {
+  uint32_t tick;           /* tick of side's clock when the event happened */
+  uint32_t seq;
+  uint32_t conn;           /* the connection's trace id */
+  uint16_t aux;
+  uint8_t type;            /* SR_EV_ */
+  uint8_t side;
+};
+
+/* sr.c records only while this is set, with sr_trace_start().  Atomic, as
+   sr_trace_stop() may clear it while other threads record; they read it
+   relaxed, so a thread may record a few events past the stop */
+extern _Atomic int sr_trace_enabled;
+
+/* start recording, keeping the last events_per_thread events of every thread */
+extern int sr_trace_start(unsigned int events_per_thread);
+extern void sr_trace_stop(void);
+
+/* Saves every thread's ring, oldest event first.  Events recorded while
+   this runs may be torn, stop recording first for an exact trace.
+
+   File layout, in the byte order of the machine that wrote it:
+   the 8 bytes "SRTRACE1", uint32_t number of rings, then for every
+   ring uint32_t thread, uint32_t count and count struct sr_trace_event. */
+extern int sr_trace_write(const char *path);
+
+extern void sr_trace_record(uint32_t conn, int type, int side, uint32_t seq, uint32_t tick, int aux);
+/* a new trace id for a connection */
+extern uint32_t sr_trace_conn_id(void);
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sr_trace.h"
+
+/* ******************************************************************
+   Prints a trace saved by sr_trace_write() as the messages sr.c prints
+   with TRACE on, one thread after the other, each line prefixed with the
+   thread, the connection and the tick of that end's clock.  The default
+   connection the emulator drives is connection 0.
+
+   Build and run, for example
+     gcc -O2 -o sr_trace_decode sr_trace_decode.c
+     ./sr -n 1000 -l 0.1 -R trace.bin && ./sr_trace_decode trace.bin
+**********************************************************************/
+
+#define A 0
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-c conn] tracefile\n"
+         "  -c  print only the events of this connection\n", prog);
+}
+
+static void print_event(const char *prefix, const struct sr_trace_event *e)
+{
+  char side = e->side == A ? 'A' : 'B';
+
+  switch (e->type) {
+  case SR_EV_SEND:
+    if (e->side == A)
+      printf("%sSending packet %u to layer 3\n", prefix, (unsigned int)e->seq);
+    else
+      printf("%sSending packet %u from B to layer 3\n", prefix, (unsigned int)e->seq);
+    break;
+  case SR_EV_RESEND:
+    printf("%s----%c: time out,resend packet %u! (send %u)\n", prefix, side, (unsigned int)e->seq,
+           (unsigned int)e->aux);
+    break;
+  case SR_EV_QUEUED:
+    printf("%s----%c: New message arrives, send window is full, message queued (%u waiting)\n", prefix,
+           side, (unsigned int)e->aux);
+    break;
+  case SR_EV_WINDOWFULL:
+    printf("%s----%c: New message arrives, send window is full\n", prefix, side);
+    break;
+  case SR_EV_ACK:
+    printf("%s----%c: uncorrupted ACK %d is received\n", prefix, side, (int)e->seq);
+    printf("%s----%c: ACK %d is not a duplicate (%u packets acknowledged)\n", prefix,
+           side, (int)e->seq, (unsigned int)e->aux);
+    break;
+  case SR_EV_DUPACK:
+    printf("%s----%c: uncorrupted ACK %d is received\n", prefix, side, (int)e->seq);
+    printf("%s----%c: duplicate ACK received, do nothing!\n", prefix, side);
+    break;
+  case SR_EV_CORRUPT:
+    if (e->side == A)
+      printf("%s----A: corrupted ACK is received, do nothing!\n", prefix);
+    else
+      printf("%s----B: packet corrupted or not expected sequence number, resend ACK!\n", prefix);
+    break;
+  case SR_EV_RECEIVE:
+    printf("%s----%c: packet %u is correctly received, send ACK!\n", prefix, side, (unsigned int)e->seq);
+    break;
+  case SR_EV_BUFFER:
+    printf("%s----%c: packet %u is correctly received, send ACK!\n", prefix, side, (unsigned int)e->seq);
+    printf("%s----%c: packet %u received and buffered\n", prefix, side, (unsigned int)e->seq);
+    break;
+  case SR_EV_DUP:
+    printf("%s----%c: packet %u is correctly received, send ACK!\n", prefix, side, (unsigned int)e->seq);
+    printf("%s----%c: duplicate packet %u received, already buffered\n", prefix, side, (unsigned int)e->seq);
+    break;
+  case SR_EV_DELIVER:
+    printf("%s----%c: packet %u delivered to layer 5\n", prefix, side, (unsigned int)e->seq);
+    break;
+  case SR_EV_ACKSENT:
+    printf("%s----%c: ACK %u sent\n", prefix, side, (unsigned int)e->seq);
+    break;
+  case SR_EV_TIMER:
+    printf("%s----%c: delayed ACK timer expired, ACK %u\n", prefix, side, (unsigned int)e->seq);
+    break;
+  case SR_EV_RTT:
+    printf("%s----%c: RTT sample %u, timeout %u\n", prefix, side, (unsigned int)e->aux, (unsigned int)e->seq);
+    break;
+  case SR_EV_PARITY:
+    printf("%s----%c: parity for %u packets from %u sent\n", prefix, side, (unsigned int)e->aux,
+           (unsigned int)e->seq);
+    break;
+  case SR_EV_REPAIR:
+    printf("%s----%c: packet %u rebuilt from parity\n", prefix, side, (unsigned int)e->seq);
+    break;
+  case SR_EV_RSREPAIR:
+    printf("%s----%c: repair packet %u over %u packets from %u sent\n", prefix, side,
+           (unsigned int)e->aux >> 8, (unsigned int)e->aux & 255, (unsigned int)e->seq);
+    break;
+  case SR_EV_RSDECODE:
+    printf("%s----%c: packet %u decoded from repair packets\n", prefix, side, (unsigned int)e->seq);
+    break;
+  default:
+    printf("%sunknown event %u, side %u, seq %u, aux %u\n", prefix, (unsigned int)e->type,
+           (unsigned int)e->side, (unsigned int)e->seq, (unsigned int)e->aux);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  FILE *f;
+  const char *path = NULL;
+  char magic[8];
+  struct sr_trace_event e;
+  char prefix[64];
+  unsigned long conn = 0;
+  int filter = 0;
+  uint32_t nrings, thread, count, r, i;
+  int j;
+
+  for (j = 1; j < argc; j++) {
+    if (strcmp(argv[j], "-c") == 0 && j + 1 < argc) {
+      conn = strtoul(argv[++j], NULL, 10);
+      filter = 1;
+    } else if (argv[j][0] != '-' && path == NULL)
+      path = argv[j];
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (path == NULL) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    printf("sr_trace_decode: cannot open %s\n", path);
+    return 1;
+  }
+  if (fread(magic, 1, 8, f) != 8 || memcmp(magic, "SRTRACE1", 8) != 0
+      || fread(&nrings, sizeof(nrings), 1, f) != 1) {
+    printf("sr_trace_decode: %s is not a trace\n", path);
+    return 1;
+  }
+  for (r = 0; r < nrings; r++) {
+    if (fread(&thread, sizeof(thread), 1, f) != 1 || fread(&count, sizeof(count), 1, f) != 1) {
+      printf("sr_trace_decode: %s is truncated\n", path);
+      return 1;
+    }
+    for (i = 0; i < count; i++) {
+      if (fread(&e, sizeof(e), 1, f) != 1) {
+        printf("sr_trace_decode: %s is truncated\n", path);
+        return 1;
+      }
+      if (filter && e.conn != conn)
+        continue;
+      sprintf(prefix, "[thread %u conn %u tick %u] ", (unsigned int)thread, (unsigned int)e.conn,
+              (unsigned int)e.tick);
+      print_event(prefix, &e);
+    }
+  }
+  fclose(f);
+  return 0;
+}